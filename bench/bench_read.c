@@ -0,0 +1,128 @@
+// bench/bench_read.c
+//
+// Micro-benchmark for read_from_buffer: the block copier in frames.h against
+// the per-frame double-cursor loop it replaced. Both are run over the same
+// buffer in device-sized blocks, forward and reverse with looping, and their
+// output is compared before timings are reported.
+//
+// usage: novaaudio_bench_read [seconds-of-audio] [block-frames]
+
+#include "frames.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// The loop read_from_buffer used before frames_read, kept verbatim as the baseline.
+static uint32_t legacy_read(const int16_t* pcm, uint64_t frames, double* cursor,
+                            int rev, int loop, int16_t* out, uint32_t outFrames)
+{
+    for (uint32_t i = 0; i < outFrames; i++) {
+        if (!rev) {
+            if (*cursor >= (double)(frames - 1)) {
+                if (loop) *cursor = 0.0;
+                else return i;
+            }
+        } else {
+            if (*cursor <= 0.0) {
+                if (loop) *cursor = (double)(frames - 1);
+                else return i;
+            }
+        }
+
+        uint64_t idx = (uint64_t)*cursor;
+        const int16_t* p = pcm + idx * 2;
+        out[i*2 + 0] = p[0];
+        out[i*2 + 1] = p[1];
+
+        *cursor += rev ? -1.0 : 1.0;
+    }
+    return outFrames;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Renders `total` frames in `block`-sized reads; returns frames per second.
+static double run(int legacy, const int16_t* pcm, uint64_t frames, int rev,
+                  int16_t* out, uint32_t block, uint64_t total)
+{
+    double dc = rev ? (double)(frames - 1) : 0.0;
+    uint64_t ic = rev ? frames - 1 : 0;
+    uint64_t done = 0;
+
+    double t0 = now_sec();
+    while (done < total) {
+        uint32_t got = legacy ? legacy_read(pcm, frames, &dc, rev, 1, out, block)
+                              : frames_read(pcm, frames, &ic, rev, 1, out, block);
+        done += got;
+    }
+    double dt = now_sec() - t0;
+    return (double)done / dt;
+}
+
+static int verify(const int16_t* pcm, uint64_t frames, int rev, uint32_t block, uint64_t total)
+{
+    int16_t* a = (int16_t*)malloc((size_t)block * 2 * sizeof(int16_t));
+    int16_t* b = (int16_t*)malloc((size_t)block * 2 * sizeof(int16_t));
+    double dc = rev ? (double)(frames - 1) : 0.0;
+    uint64_t ic = rev ? frames - 1 : 0;
+    int ok = a && b;
+
+    for (uint64_t done = 0; ok && done < total; done += block) {
+        uint32_t na = legacy_read(pcm, frames, &dc, rev, 1, a, block);
+        uint32_t nb = frames_read(pcm, frames, &ic, rev, 1, b, block);
+        ok = na == nb && memcmp(a, b, (size_t)na * 2 * sizeof(int16_t)) == 0;
+    }
+    free(a);
+    free(b);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = (argc >= 2) ? atof(argv[1]) : 60.0;
+    uint32_t block = (argc >= 3) ? (uint32_t)atoi(argv[2]) : 512;
+    if (seconds <= 0.0 || block == 0) {
+        fprintf(stderr, "usage: %s [seconds-of-audio] [block-frames]\n", argv[0]);
+        return 1;
+    }
+
+    uint64_t frames = (uint64_t)(seconds * 48000.0);
+    int16_t* pcm = (int16_t*)malloc((size_t)frames * 2 * sizeof(int16_t));
+    int16_t* out = (int16_t*)malloc((size_t)block * 2 * sizeof(int16_t));
+    if (!pcm || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    uint32_t x = 12345;
+    for (uint64_t i = 0; i < frames * 2; i++) {
+        x = x * 1664525u + 1013904223u;
+        pcm[i] = (int16_t)(x >> 16);
+    }
+
+    // Several passes over the buffer so loop wrap-around is exercised too.
+    uint64_t total = frames * 4;
+
+    for (int rev = 0; rev <= 1; rev++) {
+        if (!verify(pcm, frames, rev, block, frames * 2 + 3 * block)) {
+            fprintf(stderr, "MISMATCH: block copier differs from legacy loop (%s)\n",
+                    rev ? "reverse" : "forward");
+            return 2;
+        }
+        double fl = run(1, pcm, frames, rev, out, block, total);
+        double fb = run(0, pcm, frames, rev, out, block, total);
+        printf("%-7s block=%-5u legacy %8.1f Mframes/s | block copier %8.1f Mframes/s | %5.1fx\n",
+               rev ? "reverse" : "forward", block, fl * 1e-6, fb * 1e-6, fb / fl);
+    }
+
+    free(out);
+    free(pcm);
+    return 0;
+}
@@ -0,0 +1,314 @@
+// bench/bench_sonic.c
+//
+// Benchmark for the sonic time-stretch hot path at 48 kHz stereo. Each run
+// plays one signal through a fresh stream the way render_track does: output
+// is pulled in device-sized callbacks and sonic is fed just enough input to
+// fill them. Every callback is timed individually.
+//
+// Signals: a file (default audio/s.wav, decoded and resampled to 48 kHz),
+// a log sine sweep, white noise and a speech-like pulse train. Swept over
+// tempo 0.5 - 2.0, quality 0/1 (AMDF) plus the FFT pitch search, and callback
+// sizes 64 - 4096 frames.
+//
+// Results go to stdout (or --out) as JSON, one object per run, so they can be
+// diffed across commits.
+//
+// usage: novaaudio_bench_sonic [--file PATH] [--seconds N] [--out PATH]
+
+#define MA_API static
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
+
+#include "sonic.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define BENCH_RATE      48000
+#define BENCH_CHANNELS  2
+
+static const float kTempos[] = { 0.5f, 0.75f, 1.0f, 1.25f, 1.5f, 2.0f };
+// Pitch search settings: AMDF at quality 0 and 1, then FFT (quality-independent).
+static const struct { int quality; int method; const char* name; } kPitch[] = {
+    { 0, SONIC_PITCH_AMDF, "amdf" },
+    { 1, SONIC_PITCH_AMDF, "amdf" },
+    { 1, SONIC_PITCH_FFT,  "fft"  },
+};
+static const uint32_t kBlocks[] = { 64, 256, 1024, 4096 };
+
+typedef struct {
+    const char* name;
+    int16_t* pcm;      // interleaved stereo
+    uint64_t frames;
+} Signal;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static long peak_rss_kb(void)
+{
+#ifndef _WIN32
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+    return ru.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// ---------------- Signals ----------------
+
+static int16_t to_s16(double v)
+{
+    if (v > 1.0) v = 1.0;
+    if (v < -1.0) v = -1.0;
+    return (int16_t)lrint(v * 32767.0);
+}
+
+static int signal_alloc(Signal* s, const char* name, uint64_t frames)
+{
+    s->name = name;
+    s->frames = frames;
+    s->pcm = (int16_t*)malloc((size_t)frames * BENCH_CHANNELS * sizeof(int16_t));
+    return s->pcm != NULL;
+}
+
+// Exponential sweep 50 Hz -> 10 kHz, slightly detuned between channels.
+static int make_sweep(Signal* s, uint64_t frames)
+{
+    if (!signal_alloc(s, "sweep", frames)) return 0;
+    const double f0 = 50.0, f1 = 10000.0, T = (double)frames / BENCH_RATE;
+    const double k = log(f1 / f0);
+    for (uint64_t i = 0; i < frames; i++) {
+        double t = (double)i / BENCH_RATE;
+        double ph = 2.0 * M_PI * f0 * T / k * (exp(t / T * k) - 1.0);
+        s->pcm[i*2 + 0] = to_s16(0.5 * sin(ph));
+        s->pcm[i*2 + 1] = to_s16(0.5 * sin(ph * 1.001));
+    }
+    return 1;
+}
+
+static int make_noise(Signal* s, uint64_t frames)
+{
+    if (!signal_alloc(s, "noise", frames)) return 0;
+    uint32_t x = 0x12345678u;
+    for (uint64_t i = 0; i < frames * BENCH_CHANNELS; i++) {
+        x = x * 1664525u + 1013904223u;
+        s->pcm[i] = (int16_t)((int32_t)(x >> 16) - 32768) / 2;
+    }
+    return 1;
+}
+
+// Glottal-like pulse train (f0 gliding 90 - 220 Hz) through two resonators
+// near the first formants, gated into ~4 syllables per second. Periodic like
+// voiced speech, which is what sonic's pitch search is built for.
+static int make_pulses(Signal* s, uint64_t frames)
+{
+    if (!signal_alloc(s, "pulses", frames)) return 0;
+
+    const double fr[2] = { 700.0, 1200.0 }, bw = 90.0;
+    double a1[2], a2[2], y1[2] = {0}, y2[2] = {0};
+    for (int r = 0; r < 2; r++) {
+        double rad = exp(-M_PI * bw / BENCH_RATE);
+        a1[r] = 2.0 * rad * cos(2.0 * M_PI * fr[r] / BENCH_RATE);
+        a2[r] = -rad * rad;
+    }
+
+    double phase = 0.0;
+    for (uint64_t i = 0; i < frames; i++) {
+        double t = (double)i / BENCH_RATE;
+        double f0 = 155.0 + 65.0 * sin(2.0 * M_PI * 0.3 * t);
+        phase += f0 / BENCH_RATE;
+        double x = 0.0;
+        if (phase >= 1.0) {
+            phase -= 1.0;
+            x = 1.0;
+        }
+        double v = 0.0;
+        for (int r = 0; r < 2; r++) {
+            double y = x + a1[r] * y1[r] + a2[r] * y2[r];
+            y2[r] = y1[r];
+            y1[r] = y;
+            v += y;
+        }
+        double gate = 0.5 - 0.5 * cos(2.0 * M_PI * 4.0 * t);
+        int16_t o = to_s16(0.05 * v * gate);
+        s->pcm[i*2 + 0] = o;
+        s->pcm[i*2 + 1] = o;
+    }
+    return 1;
+}
+
+static int load_file(Signal* s, const char* path, uint64_t maxFrames)
+{
+    ma_decoder_config cfg = ma_decoder_config_init(ma_format_s16, BENCH_CHANNELS, BENCH_RATE);
+    ma_uint64 frames = 0;
+    void* pcm = NULL;
+    if (ma_decode_file(path, &cfg, &frames, &pcm) != MA_SUCCESS) {
+        fprintf(stderr, "Cannot decode %s, skipping the file signal\n", path);
+        return 0;
+    }
+    if (frames > maxFrames) frames = maxFrames;
+
+    if (!signal_alloc(s, "file", frames)) {
+        ma_free(pcm, NULL);
+        return 0;
+    }
+    memcpy(s->pcm, pcm, (size_t)frames * BENCH_CHANNELS * sizeof(int16_t));
+    ma_free(pcm, NULL);
+    return 1;
+}
+
+// ---------------- Runs ----------------
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// 0 when no callback ran (a tiny --seconds, or an empty --file).
+static double percentile_us(const uint64_t* sorted, size_t n, double p)
+{
+    if (n == 0) return 0.0;
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+    return (double)sorted[i] * 1e-3;
+}
+
+// One stream, one signal, one setting. Returns 0 on allocation failure.
+static int run(FILE* json, int first, const Signal* sig, float tempo, int quality,
+               int method, const char* methodName, uint32_t block,
+               int16_t* out, uint64_t* times, size_t maxCallbacks)
+{
+    sonicStream st = sonicCreateStream(BENCH_RATE, BENCH_CHANNELS);
+    if (!st) return 0;
+    sonicSetSpeed(st, tempo);
+    sonicSetQuality(st, quality);
+    if (!sonicSetPitchMethod(st, method)) {
+        sonicDestroyStream(st);
+        return 0;
+    }
+
+    uint64_t in = 0, produced = 0, total = 0;
+    size_t callbacks = 0;
+
+    while (in < sig->frames && callbacks < maxCallbacks) {
+        uint64_t t0 = now_ns();
+
+        uint32_t written = 0;
+        while (written < block) {
+            if (sonicSamplesAvailable(st) > 0) {
+                int got = sonicReadShortFromStream(st, out + (size_t)written * 2, (int)(block - written));
+                if (got <= 0) break;
+                written += (uint32_t)got;
+                continue;
+            }
+            uint64_t want = (uint64_t)((float)(block - written) * tempo) + 1;
+            if (want > sig->frames - in) want = sig->frames - in;
+            if (want == 0) break;
+            sonicWriteShortToStream(st, sig->pcm + in * 2, (int)want);
+            in += want;
+        }
+
+        uint64_t dt = now_ns() - t0;
+        times[callbacks++] = dt;
+        total += dt;
+        produced += written;
+    }
+    sonicDestroyStream(st);
+
+    qsort(times, callbacks, sizeof(times[0]), cmp_u64);
+    fprintf(json,
+        "%s    {\"signal\": \"%s\", \"tempo\": %.2f, \"quality\": %d, \"pitch\": \"%s\", \"block\": %u, "
+        "\"frames_in\": %llu, \"frames_out\": %llu, \"callbacks\": %zu, "
+        "\"ns_per_in_frame\": %.2f, \"ns_per_out_frame\": %.2f, "
+        "\"callback_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}, "
+        "\"budget_pct_p99\": %.2f}",
+        first ? "" : ",\n", sig->name, tempo, quality, methodName, block,
+        (unsigned long long)in, (unsigned long long)produced, callbacks,
+        in ? (double)total / (double)in : 0.0,
+        produced ? (double)total / (double)produced : 0.0,
+        percentile_us(times, callbacks, 0.50), percentile_us(times, callbacks, 0.90),
+        percentile_us(times, callbacks, 0.99), percentile_us(times, callbacks, 0.999),
+        callbacks ? (double)times[callbacks - 1] * 1e-3 : 0.0,
+        // share of the callback's real-time budget used at p99
+        percentile_us(times, callbacks, 0.99) * 1e-6 * BENCH_RATE / block * 100.0);
+    fflush(json);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* file = "audio/s.wav";
+    const char* outPath = NULL;
+    double seconds = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) file = argv[++i];
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) outPath = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--file PATH] [--seconds N] [--out PATH]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0.0) seconds = 10.0;
+    uint64_t frames = (uint64_t)(seconds * BENCH_RATE);
+
+    Signal sigs[4];
+    int n = 0;
+    if (file[0] && load_file(&sigs[n], file, frames)) n++;
+    if (make_sweep(&sigs[n], frames)) n++;
+    if (make_noise(&sigs[n], frames)) n++;
+    if (make_pulses(&sigs[n], frames)) n++;
+
+    // Worst case is the slowest tempo with the smallest block.
+    size_t maxCallbacks = (size_t)(frames / 0.5 / kBlocks[0]) + 16;
+    uint64_t* times = (uint64_t*)malloc(maxCallbacks * sizeof(uint64_t));
+    int16_t* out = (int16_t*)malloc((size_t)kBlocks[3] * BENCH_CHANNELS * sizeof(int16_t));
+    FILE* json = outPath ? fopen(outPath, "w") : stdout;
+    if (!times || !out || !json) {
+        fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+
+    fprintf(json, "{\n  \"bench\": \"sonic\",\n  \"sample_rate\": %d,\n  \"channels\": %d,\n"
+                  "  \"seconds_per_signal\": %.1f,\n  \"runs\": [\n",
+            BENCH_RATE, BENCH_CHANNELS, seconds);
+
+    int first = 1;
+    for (int s = 0; s < n; s++)
+    for (size_t q = 0; q < sizeof(kPitch) / sizeof(kPitch[0]); q++)
+    for (size_t t = 0; t < sizeof(kTempos) / sizeof(kTempos[0]); t++)
+    for (size_t b = 0; b < sizeof(kBlocks) / sizeof(kBlocks[0]); b++) {
+        if (!run(json, first, &sigs[s], kTempos[t], kPitch[q].quality, kPitch[q].method,
+                 kPitch[q].name, kBlocks[b], out, times, maxCallbacks)) {
+            fprintf(stderr, "Failed to set up a sonic stream\n");
+            return 1;
+        }
+        first = 0;
+    }
+
+    fprintf(json, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+    if (json != stdout) fclose(json);
+
+    for (int s = 0; s < n; s++) free(sigs[s].pcm);
+    free(out);
+    free(times);
+    return 0;
+}
@@ -0,0 +1,220 @@
+// src/cache.c
+//
+// novaaudio_cache: looks after the decoded-PCM cache the engine keeps for
+// files it loads whole (see pcmcache.h). `prewarm` decodes every audio file
+// under the given paths ahead of time, so the first load in the UI is already
+// a cache hit; `stats` and `trim` report on and shrink the cache directory.
+
+#include "engine.h"
+#include "pcmcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+typedef struct {
+    const char* command;
+    const char** paths;
+    int pathCount;
+    const char* dir;
+    uint64_t maxBytes;    // 0: the cache's default cap
+    int resampleLinear;
+    int loadThreads;
+} CacheOptions;
+
+typedef struct {
+    Engine* e;
+    unsigned stored, skipped, failed;
+} Prewarm;
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+        "usage: %s prewarm <file or directory>... [options]\n"
+        "       %s stats [options]\n"
+        "       %s trim [options]\n"
+        "  --cache DIR      cache directory (default $NOVA_CACHE_DIR, else\n"
+        "                   $XDG_CACHE_HOME/novaaudio, else ~/.cache/novaaudio)\n"
+        "  --max-mb N       size cap in MiB, enforced after every store and by trim\n"
+        "                   (default %llu)\n"
+        "  --resample Q     prewarm for sinc or linear conversion, as the player\n"
+        "                   will load (default sinc)\n"
+        "  --load-threads N threads decoding MP3 and converting, 0 for one per CPU (default 0)\n",
+        argv0, argv0, argv0, (unsigned long long)(PCM_CACHE_DEFAULT_MAX_BYTES >> 20));
+}
+
+static int parse_args(int argc, char** argv, CacheOptions* o)
+{
+    memset(o, 0, sizeof(*o));
+    if (argc < 2) return 0;
+    o->command = argv[1];
+    o->paths = (const char**)calloc((size_t)argc, sizeof(*o->paths));
+    if (!o->paths) return 0;
+
+    for (int i = 2; i < argc; i++) {
+        const char* a = argv[i];
+        int hasValue = i + 1 < argc;
+
+        if (strcmp(a, "--cache") == 0 && hasValue) {
+            o->dir = argv[++i];
+        } else if (strcmp(a, "--max-mb") == 0 && hasValue) {
+            long long mb = atoll(argv[++i]);
+            if (mb <= 0) {
+                fprintf(stderr, "Invalid --max-mb\n");
+                return 0;
+            }
+            o->maxBytes = (uint64_t)mb << 20;
+        } else if (strcmp(a, "--resample") == 0 && hasValue) {
+            const char* q = argv[++i];
+            if (strcmp(q, "linear") == 0) o->resampleLinear = 1;
+            else if (strcmp(q, "sinc") != 0) {
+                fprintf(stderr, "Unknown resampler: %s\n", q);
+                return 0;
+            }
+        } else if (strcmp(a, "--load-threads") == 0 && hasValue) {
+            o->loadThreads = atoi(argv[++i]);
+        } else if (a[0] == '-' && a[1] == '-') {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", a);
+            return 0;
+        } else {
+            o->paths[o->pathCount++] = a;
+        }
+    }
+
+    if (strcmp(o->command, "prewarm") == 0) return o->pathCount > 0;
+    if (strcmp(o->command, "stats") == 0 || strcmp(o->command, "trim") == 0) {
+        if (o->pathCount == 0) return 1;
+        fprintf(stderr, "Unexpected argument: %s\n", o->paths[0]);
+        return 0;
+    }
+    fprintf(stderr, "Unknown command: %s\n", o->command);
+    return 0;
+}
+
+// ---------------- Prewarm ----------------
+
+// Extensions miniaudio decodes; anything else in a directory is skipped.
+static int is_audio_file(const char* name)
+{
+    static const char* const exts[] = { ".mp3", ".wav", ".flac" };
+    const char* dot = strrchr(name, '.');
+    if (!dot) return 0;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strcasecmp(dot, exts[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static void prewarm_file(Prewarm* w, const char* path)
+{
+    int r = engine_prewarm(w->e, path);
+    if (r > 0) w->stored++;
+    else if (r == 0) w->skipped++;
+    else {
+        w->failed++;
+        fprintf(stderr, "Not cached: %s\n", path);
+    }
+}
+
+// Walks `path` depth first. Files named explicitly are tried whatever their
+// extension; files found in directories only when they look like audio.
+static void prewarm_path(Prewarm* w, const char* path, int explicit)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Cannot stat: %s\n", path);
+        w->failed++;
+        return;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (explicit || is_audio_file(path)) prewarm_file(w, path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) return;
+
+    DIR* d = opendir(path);
+    if (!d) {
+        fprintf(stderr, "Cannot open directory: %s\n", path);
+        w->failed++;
+        return;
+    }
+    size_t baseLen = strlen(path);
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue; // ., .. and hidden files
+        size_t len = baseLen + 1 + strlen(de->d_name) + 1;
+        char* child = (char*)malloc(len);
+        if (!child) break;
+        snprintf(child, len, "%s/%s", path, de->d_name);
+        prewarm_path(w, child, 0);
+        free(child);
+    }
+    closedir(d);
+}
+
+static int prewarm(const CacheOptions* o, const char* dir)
+{
+    Engine* e = engine_create();
+    if (!e) return 2;
+    engine_set_resample(e, !o->resampleLinear, o->loadThreads);
+    if (!engine_set_cache(e, dir, o->maxBytes)) {
+        fprintf(stderr, "Cannot use cache directory: %s\n", dir);
+        engine_destroy(e);
+        return 2;
+    }
+
+    Prewarm w = { .e = e };
+    for (int i = 0; i < o->pathCount; i++) prewarm_path(&w, o->paths[i], 1);
+    engine_destroy(e);
+
+    printf("%u decoded into %s, %u already cached or played in place, %u failed\n",
+           w.stored, dir, w.skipped, w.failed);
+    return w.failed ? 1 : 0;
+}
+
+// ---------------- Stats and trim ----------------
+
+static int report(const CacheOptions* o, const char* dir, int trim)
+{
+    PcmCache* c = pcm_cache_open(dir, o->maxBytes);
+    if (!c) {
+        fprintf(stderr, "Cannot use cache directory: %s\n", dir);
+        return 2;
+    }
+    PcmCacheStats left;
+    pcm_cache_trim(c, trim ? 0 : UINT64_MAX, &left);
+    pcm_cache_close(c);
+
+    printf("%s: %llu entries, %.1f MiB\n", dir, (unsigned long long)left.entries,
+           (double)left.bytes / (1024.0 * 1024.0));
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    CacheOptions o;
+    if (!parse_args(argc, argv, &o)) {
+        usage(argv[0]);
+        free(o.paths);
+        return 1;
+    }
+
+    char dir[1024];
+    if (o.dir) {
+        snprintf(dir, sizeof(dir), "%s", o.dir);
+    } else if (!pcm_cache_default_dir(dir, sizeof(dir))) {
+        fprintf(stderr, "No cache directory: set NOVA_CACHE_DIR or pass --cache\n");
+        free(o.paths);
+        return 2;
+    }
+
+    int rc;
+    if (strcmp(o.command, "prewarm") == 0) rc = prewarm(&o, dir);
+    else rc = report(&o, dir, strcmp(o.command, "trim") == 0);
+    free(o.paths);
+    return rc;
+}
@@ -0,0 +1,3149 @@
+// src/engine.c
+//
+// See engine.h. Holds the miniaudio implementation, so every ma_* call lives
+// in this file.
+
+// pthread_setaffinity_np for the render workers; must precede every include.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+// Make miniaudio symbols private to this TU to avoid any collision with raylib's bundled miniaudio.
+#define MA_API static
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
+
+#include "engine.h"
+#include "sonic.h"
+#include "frames.h"
+#include "pcmcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+typedef struct {
+    int16_t* pcm;         // interleaved s16 stereo
+    uint64_t frames;      // number of frames
+    uint32_t channels;    // 2
+    uint32_t sampleRate;  // 48000
+    void* map;            // non-NULL when pcm points into a mapped file
+    size_t mapLen;
+} BufferS16;
+
+static void buffer_free(BufferS16* b)
+{
+#ifndef _WIN32
+    if (b->map) munmap(b->map, b->mapLen);
+    else
+#endif
+    if (b->pcm) free(b->pcm);
+    memset(b, 0, sizeof(*b));
+}
+
+// ---------------- Probing ----------------
+// A load opens its file exactly once. The size decides between streaming and
+// decoding whole, the magic bytes pick the decoder (so miniaudio does not try
+// each backend in turn), and the same handle then feeds the WAV mapper or
+// ma_decoder through FileVfs. The probe owns the handle; FileVfs never closes
+// it, so a failed decoder init can be retried without reopening.
+
+#ifdef _WIN32
+#define file_seek _fseeki64
+#define file_tell _ftelli64
+#else
+#define file_seek fseeko
+#define file_tell ftello
+#endif
+
+typedef struct {
+    FILE* file;
+    uint64_t size;
+    ma_encoding_format encoding; // from the magic bytes, unknown if unrecognized
+} FileProbe;
+
+static ma_encoding_format probe_magic(const uint8_t* h, size_t n)
+{
+    if (n >= 12 && (memcmp(h, "RIFF", 4) == 0 || memcmp(h, "RIFX", 4) == 0 ||
+                    memcmp(h, "RF64", 4) == 0) && memcmp(h + 8, "WAVE", 4) == 0) {
+        return ma_encoding_format_wav;
+    }
+    if (n >= 4 && memcmp(h, "riff", 4) == 0) return ma_encoding_format_wav; // Wave64
+    if (n >= 4 && memcmp(h, "fLaC", 4) == 0) return ma_encoding_format_flac;
+    if (n >= 4 && memcmp(h, "OggS", 4) == 0) return ma_encoding_format_vorbis;
+    // MPEG audio frame sync with a non-zero layer (ADTS AAC has layer 0).
+    if (n >= 2 && h[0] == 0xFF && (h[1] & 0xE0) == 0xE0 && (h[1] & 0x06) != 0) {
+        return ma_encoding_format_mp3;
+    }
+    return ma_encoding_format_unknown;
+}
+
+// Opens `path` and sniffs its encoding, looking past a leading ID3v2 tag.
+// Returns 0 if the file can't be opened; an unknown encoding is not an error.
+static int probe_open(const char* path, FileProbe* p)
+{
+    memset(p, 0, sizeof(*p));
+    p->file = fopen(path, "rb");
+    if (!p->file) return 0;
+
+    struct stat st;
+    if (fstat(fileno(p->file), &st) == 0) p->size = (uint64_t)st.st_size;
+
+    uint8_t h[12];
+    size_t n = fread(h, 1, sizeof(h), p->file);
+    if (n >= 10 && memcmp(h, "ID3", 3) == 0) {
+        uint64_t skip = 10 + (((uint64_t)(h[6] & 0x7F) << 21) | ((uint64_t)(h[7] & 0x7F) << 14) |
+                              ((uint64_t)(h[8] & 0x7F) << 7) | (uint64_t)(h[9] & 0x7F));
+        if (h[5] & 0x10) skip += 10; // footer
+        n = file_seek(p->file, (int64_t)skip, SEEK_SET) == 0 ? fread(h, 1, sizeof(h), p->file) : 0;
+    }
+    p->encoding = probe_magic(h, n);
+    rewind(p->file);
+    return 1;
+}
+
+static void probe_close(FileProbe* p)
+{
+    if (p->file) fclose(p->file);
+    p->file = NULL;
+}
+
+// ma_vfs over one already-open FILE*: every open yields that handle, rewound.
+// The callbacks struct must come first, miniaudio casts ma_vfs* to it.
+typedef struct {
+    ma_vfs_callbacks cb;
+    FILE* file;
+} FileVfs;
+
+static ma_result file_vfs_open(ma_vfs* vfs, const char* path, ma_uint32 mode, ma_vfs_file* out)
+{
+    (void)path;
+    FILE* f = ((FileVfs*)vfs)->file;
+    if ((mode & MA_OPEN_MODE_WRITE) || !f) return MA_ACCESS_DENIED;
+    rewind(f);
+    *out = (ma_vfs_file)f;
+    return MA_SUCCESS;
+}
+
+static ma_result file_vfs_close(ma_vfs* vfs, ma_vfs_file file)
+{
+    (void)vfs; (void)file;
+    return MA_SUCCESS;
+}
+
+static ma_result file_vfs_read(ma_vfs* vfs, ma_vfs_file file, void* dst, size_t bytes, size_t* read)
+{
+    (void)vfs;
+    size_t n = fread(dst, 1, bytes, (FILE*)file);
+    if (read) *read = n;
+    if (n == bytes) return MA_SUCCESS;
+    return ferror((FILE*)file) ? MA_IO_ERROR : (n == 0 ? MA_AT_END : MA_SUCCESS);
+}
+
+static ma_result file_vfs_seek(ma_vfs* vfs, ma_vfs_file file, ma_int64 offset, ma_seek_origin origin)
+{
+    (void)vfs;
+    int whence = origin == ma_seek_origin_start ? SEEK_SET
+               : origin == ma_seek_origin_end   ? SEEK_END : SEEK_CUR;
+    return file_seek((FILE*)file, offset, whence) == 0 ? MA_SUCCESS : MA_ERROR;
+}
+
+static ma_result file_vfs_tell(ma_vfs* vfs, ma_vfs_file file, ma_int64* cursor)
+{
+    (void)vfs;
+    ma_int64 at = (ma_int64)file_tell((FILE*)file);
+    if (at < 0) return MA_ERROR;
+    *cursor = at;
+    return MA_SUCCESS;
+}
+
+static ma_result file_vfs_info(ma_vfs* vfs, ma_vfs_file file, ma_file_info* info)
+{
+    (void)vfs;
+    struct stat st;
+    if (fstat(fileno((FILE*)file), &st) != 0) return MA_ERROR;
+    info->sizeInBytes = (ma_uint64)st.st_size;
+    return MA_SUCCESS;
+}
+
+static void file_vfs_init(FileVfs* v, FILE* f)
+{
+    memset(v, 0, sizeof(*v));
+    v->cb.onOpen  = file_vfs_open;
+    v->cb.onClose = file_vfs_close;
+    v->cb.onRead  = file_vfs_read;
+    v->cb.onSeek  = file_vfs_seek;
+    v->cb.onTell  = file_vfs_tell;
+    v->cb.onInfo  = file_vfs_info;
+    v->file = f;
+}
+
+// Initializes `dec` on the probed handle with the encoding hint, falling back
+// to miniaudio's trial and error if the hint was wrong. `v` must outlive `dec`.
+static ma_result decoder_init_probed(const FileProbe* p, FileVfs* v, ma_decoder_config cfg,
+                                     const char* path, ma_decoder* dec)
+{
+    file_vfs_init(v, p->file);
+    ma_result r = MA_NO_BACKEND;
+    if (p->encoding != ma_encoding_format_unknown) {
+        cfg.encodingFormat = p->encoding;
+        r = ma_decoder_init_vfs((ma_vfs*)v, path, &cfg, dec);
+        cfg.encodingFormat = ma_encoding_format_unknown;
+    }
+    if (r != MA_SUCCESS) r = ma_decoder_init_vfs((ma_vfs*)v, path, &cfg, dec);
+    return r;
+}
+
+// ---------------- Mapped WAV ----------------
+// PCM WAV files already in the engine format (s16, stereo, 48 kHz) are played
+// straight from the page cache: the file is mmap'ed read-only and pcm points
+// at the data chunk. Nothing is decoded or copied, and engines playing the
+// same file share its pages.
+
+static uint32_t rd_le16(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8); }
+static uint32_t rd_le32(const uint8_t* p) { return rd_le16(p) | (rd_le16(p + 2) << 16); }
+
+static int map_wav_s16_stereo48k(const FileProbe* p, const char* path, BufferS16* out)
+{
+#ifdef _WIN32
+    (void)p; (void)path; (void)out;
+    return 0;
+#else
+    memset(out, 0, sizeof(*out));
+    if (p->encoding != ma_encoding_format_wav || p->size < 44) return 0;
+
+    size_t len = (size_t)p->size;
+    uint8_t* base = (uint8_t*)mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(p->file), 0);
+    if (base == MAP_FAILED) return 0;
+
+    if (memcmp(base, "RIFF", 4) != 0 || memcmp(base + 8, "WAVE", 4) != 0) goto reject;
+
+    int fmtOk = 0;
+    size_t pos = 12;
+    while (pos + 8 <= len) {
+        const uint8_t* ck = base + pos;
+        size_t size = rd_le32(ck + 4);
+        size_t body = pos + 8;
+
+        if (memcmp(ck, "fmt ", 4) == 0 && size >= 16 && body + size <= len) {
+            uint32_t tag = rd_le16(ck + 8);
+            if (tag == 0xFFFE && size >= 40) tag = rd_le16(ck + 8 + 24); // extensible: sub-format
+            fmtOk = tag == 1 &&
+                    rd_le16(ck + 10) == 2 &&      // channels
+                    rd_le32(ck + 12) == 48000 &&  // sample rate
+                    rd_le16(ck + 22) == 16;       // bits per sample
+            if (!fmtOk) goto reject;
+        } else if (memcmp(ck, "data", 4) == 0) {
+            if (!fmtOk || (body & 1)) goto reject;
+            if (size > len - body) size = len - body; // truncated or streamed writer
+            out->pcm = (int16_t*)(base + body);
+            out->frames = size / 4;
+            break;
+        }
+        pos = body + size + (size & 1);
+    }
+    if (!out->pcm || out->frames == 0) goto reject;
+
+    out->channels = 2;
+    out->sampleRate = 48000;
+    out->map = base;
+    out->mapLen = len;
+    madvise(base, len, MADV_SEQUENTIAL);
+
+    fprintf(stderr, "Mapped OK: %s | frames=%llu | sr=48000 | ch=2\n",
+            path, (unsigned long long)out->frames);
+    return 1;
+
+reject:
+    munmap(base, len);
+    memset(out, 0, sizeof(*out));
+    return 0;
+#endif
+}
+
+// UI thread: steer kernel readahead for a mapped buffer. Forward playback is
+// sequential; reverse playback disables readahead and prefetches the region
+// behind the cursor explicitly. Either way the next few seconds in the play
+// direction are requested, so audio_cb rarely takes a major fault.
+#define MAP_PREFETCH_FRAMES  (48000u * 4)
+#define MAP_REHINT_FRAMES    (48000u / 2)
+
+static void buffer_hint(const BufferS16* b, uint64_t pos, int reverse)
+{
+#ifdef _WIN32
+    (void)b; (void)pos; (void)reverse;
+#else
+    if (!b->map) return;
+    long page = sysconf(_SC_PAGESIZE);
+    uint8_t* base = (uint8_t*)b->map;
+    uint8_t* pcm = (uint8_t*)b->pcm;
+
+    uint64_t lo = pos, hi = pos;
+    if (reverse) lo = (pos > MAP_PREFETCH_FRAMES) ? pos - MAP_PREFETCH_FRAMES : 0;
+    else hi = (pos + MAP_PREFETCH_FRAMES < b->frames) ? pos + MAP_PREFETCH_FRAMES : b->frames;
+
+    uintptr_t from = (uintptr_t)(pcm + lo * 4) & ~(uintptr_t)(page - 1);
+    uintptr_t to = (uintptr_t)(pcm + hi * 4);
+    if (from < (uintptr_t)base) from = (uintptr_t)base;
+    if (to > from) madvise((void*)from, (size_t)(to - from), MADV_WILLNEED);
+#endif
+}
+
+static void buffer_set_direction(const BufferS16* b, int reverse)
+{
+#ifndef _WIN32
+    if (b->map) madvise(b->map, b->mapLen, reverse ? MADV_RANDOM : MADV_SEQUENTIAL);
+#else
+    (void)b; (void)reverse;
+#endif
+}
+
+// ---------------- Load workers ----------------
+// Whole-file loads split their work into items that the loading thread and a
+// few helpers claim from a shared atomic counter, so the result never depends
+// on how many threads ran or which one took what.
+
+#define LOAD_MAX_THREADS 16
+
+static int cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// Runs fn(arg) on up to `threads` threads (0: one per CPU) but never more
+// than `items`, this one included, and returns when all have finished. A
+// helper that fails to start just leaves its share to the others.
+static void run_load_workers(ma_thread_entry_proc fn, void* arg, int threads, uint64_t items)
+{
+    if (threads <= 0) threads = cpu_count();
+    if ((uint64_t)threads > items) threads = (int)items;
+    if (threads > LOAD_MAX_THREADS) threads = LOAD_MAX_THREADS;
+    if (threads < 1) threads = 1;
+
+    ma_thread helpers[LOAD_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        if (ma_thread_create(&helpers[started], ma_thread_priority_normal, 0, fn, arg, NULL) == MA_SUCCESS) {
+            started++;
+        }
+    }
+    fn(arg);
+    for (int i = 0; i < started; i++) ma_thread_wait(&helpers[i]);
+}
+
+// ---------------- Load-time resampling ----------------
+// Files not at 48 kHz are decoded at their own rate and converted here rather
+// than by the decoder's streaming resampler. Output frame j sits at input
+// position j * src / 48000, kept as an exact integer index and phase, and its
+// taps come from a bank built before any worker starts, so every frame is a
+// pure function of the decoded input. The output is cut into chunks that
+// worker threads claim from a shared counter and filter independently, each
+// reading the overlapping window of input it needs; the result is the same
+// bytes whatever the thread count.
+
+#define RESAMPLE_CHUNK_FRAMES 65536u // output frames per work item
+#define RESAMPLE_MAX_PHASES   4096u  // finer ratios snap to the nearest of these
+#define RESAMPLE_SINC_ZEROS   16     // kernel zero crossings each side
+#define RESAMPLE_CUTOFF       0.92   // passband edge, fraction of the lower Nyquist
+#define RESAMPLE_KAISER_BETA  8.6    // ~85 dB stopband
+
+typedef struct {
+    const int16_t* in;   // interleaved stereo at the source rate
+    uint64_t inFrames;
+    int16_t* out;        // interleaved stereo at 48 kHz
+    uint64_t outFrames;
+    uint64_t step;       // input advance per output frame: step / phases
+    uint32_t phases;     // exact phases of the reduced ratio
+    uint32_t rows;       // rows in bank: phases, or RESAMPLE_MAX_PHASES
+    int sinc;            // windowed sinc, else linear
+    int taps;            // kernel length, a multiple of 4
+    float* bank;         // rows x taps, each row summing to 1
+    _Atomic uint64_t nextChunk;
+} Resampler;
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth-order modified Bessel function, for the Kaiser window.
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 64 && term > sum * 1e-17; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Fills row r of the bank: taps for an output frame r / rows of the way from
+// input frame i to i + 1, applied to frames i - taps/2 + 1 .. i + taps/2.
+// Linear interpolation uses the middle two.
+static void resample_build_row(Resampler* R, uint32_t r, double cutoff)
+{
+    float* row = R->bank + (size_t)r * R->taps;
+    double frac = (double)r / R->rows;
+    int half = R->taps / 2;
+
+    if (!R->sinc) {
+        memset(row, 0, (size_t)R->taps * sizeof(float));
+        row[half - 1] = (float)(1.0 - frac);
+        row[half] = (float)frac;
+        return;
+    }
+    double c[512];
+    double sum = 0.0;
+    for (int m = 0; m < R->taps; m++) {
+        double t = (m - half + 1) - frac;
+        double x = M_PI * cutoff * t;
+        double sinc = fabs(x) < 1e-12 ? 1.0 : sin(x) / x;
+        double w = t / half;
+        double win = fabs(w) >= 1.0 ? 0.0
+                   : bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1.0 - w * w)) / bessel_i0(RESAMPLE_KAISER_BETA);
+        c[m] = sinc * win;
+        sum += c[m];
+    }
+    for (int m = 0; m < R->taps; m++) row[m] = (float)(c[m] / sum);
+}
+
+static int16_t resample_quantize(float v)
+{
+    int32_t r = (int32_t)(v + copysignf(0.5f, v));
+    r = r > 32767 ? 32767 : r;
+    r = r < -32768 ? -32768 : r;
+    return (int16_t)r;
+}
+
+// Filters one stereo frame from taps frames of input x (taps a multiple of
+// 4) into lanes s[8]: s[2k + c] sums channel c of frames m with m % 4 == k.
+// The SIMD versions keep exactly those lanes, so every build of this file
+// agrees with its own scalar edge path.
+static void resample_dot(const float* c, const int16_t* x, int taps, float s[8])
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+    for (int m = 0; m < taps; m += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + 2 * m));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        __m128 k = _mm_loadu_ps(c + m);
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_unpacklo_ps(k, k), lo));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_unpackhi_ps(k, k), hi));
+    }
+    _mm_storeu_ps(s, a);
+    _mm_storeu_ps(s + 4, b);
+#elif defined(__ARM_NEON)
+    float32x4_t a = vdupq_n_f32(0.0f), b = vdupq_n_f32(0.0f);
+    for (int m = 0; m < taps; m += 4) {
+        int16x8_t v = vld1q_s16(x + 2 * m);
+        float32x4x2_t k = vzipq_f32(vld1q_f32(c + m), vld1q_f32(c + m));
+        a = vaddq_f32(a, vmulq_f32(k.val[0], vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)))));
+        b = vaddq_f32(b, vmulq_f32(k.val[1], vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)))));
+    }
+    vst1q_f32(s, a);
+    vst1q_f32(s + 4, b);
+#else
+    for (int l = 0; l < 8; l++) s[l] = 0.0f;
+    for (int m = 0; m < taps; m++) {
+        float p0 = c[m] * x[2 * m];
+        float p1 = c[m] * x[2 * m + 1];
+        s[2 * (m & 3)] += p0;
+        s[2 * (m & 3) + 1] += p1;
+    }
+#endif
+}
+
+// Output frames [from, to). Frames whose window lies inside the input are
+// read in place; the few near either end copy theirs with zeros past the
+// ends. Either way resample_dot sums them, so neither the chunking nor the
+// edges change how a frame is computed.
+static void resample_range(Resampler* R, uint64_t from, uint64_t to)
+{
+    const int taps = R->taps;
+    const int half = taps / 2;
+
+    for (uint64_t j = from; j < to; j++) {
+        uint64_t pos = j * R->step;
+        uint64_t i = pos / R->phases;
+        uint64_t p = pos % R->phases;
+        if (R->rows != R->phases) {
+            p = (p * R->rows + R->phases / 2) / R->phases;
+            if (p == R->rows) { p = 0; i++; }
+        }
+        const float* c = R->bank + (size_t)p * taps;
+        int64_t first = (int64_t)i - half + 1;
+        const int16_t* x = R->in + (size_t)(first > 0 ? first : 0) * 2;
+        int16_t edge[2 * 512];
+        float l[8];
+
+        if (first < 0 || (uint64_t)first + (uint64_t)taps > R->inFrames) {
+            for (int m = 0; m < taps; m++) {
+                int64_t f = first + m;
+                int inside = f >= 0 && (uint64_t)f < R->inFrames;
+                edge[2 * m] = inside ? R->in[(size_t)f * 2] : 0;
+                edge[2 * m + 1] = inside ? R->in[(size_t)f * 2 + 1] : 0;
+            }
+            x = edge;
+        }
+        resample_dot(c, x, taps, l);
+        R->out[(size_t)j * 2] = resample_quantize((l[0] + l[4]) + (l[2] + l[6]));
+        R->out[(size_t)j * 2 + 1] = resample_quantize((l[1] + l[5]) + (l[3] + l[7]));
+    }
+}
+static ma_thread_result MA_THREADCALL resample_worker(void* arg)
+{
+    Resampler* R = (Resampler*)arg;
+    uint64_t chunks = (R->outFrames + RESAMPLE_CHUNK_FRAMES - 1) / RESAMPLE_CHUNK_FRAMES;
+    for (;;) {
+        uint64_t c = atomic_fetch_add(&R->nextChunk, 1);
+        if (c >= chunks) break;
+        uint64_t from = c * RESAMPLE_CHUNK_FRAMES;
+        uint64_t to = from + RESAMPLE_CHUNK_FRAMES;
+        resample_range(R, from, to < R->outFrames ? to : R->outFrames);
+    }
+    return (ma_thread_result)0;
+}
+
+// Converts `frames` interleaved stereo frames at srcRate to ENGINE_SAMPLE_RATE
+// with a Kaiser-windowed sinc (sinc != 0) or linear interpolation, on
+// `threads` threads (0: one per CPU). Returns a malloc'ed buffer and its
+// length in *outFrames, or NULL when out of memory.
+static int16_t* resample_s16_stereo(const int16_t* in, uint64_t frames, uint32_t srcRate,
+                                    int sinc, int threads, uint64_t* outFrames)
+{
+    const uint64_t dst = ENGINE_SAMPLE_RATE;
+    uint64_t g = gcd_u64(srcRate, dst);
+    Resampler R = {0};
+    R.in = in;
+    R.inFrames = frames;
+    R.outFrames = (frames * dst + srcRate - 1) / srcRate;
+    R.phases = (uint32_t)(dst / g);
+    R.step = srcRate / g;
+    R.sinc = sinc;
+    R.rows = R.phases <= RESAMPLE_MAX_PHASES ? R.phases : RESAMPLE_MAX_PHASES;
+
+    // Downsampling widens the kernel so the transition band keeps its width
+    // relative to the lower rate.
+    double ratio = srcRate > dst ? (double)srcRate / dst : 1.0;
+    // resample_dot takes taps four at a time; linear pads with two zeros.
+    R.taps = 4;
+    if (sinc) {
+        R.taps = 4 * (int)ceil(RESAMPLE_SINC_ZEROS * ratio / 2);
+        if (R.taps > 512) R.taps = 512;
+    }
+
+    R.bank = (float*)malloc((size_t)R.rows * R.taps * sizeof(float));
+    R.out = (int16_t*)malloc((size_t)R.outFrames * 2 * sizeof(int16_t));
+    if (!R.bank || !R.out) {
+        free(R.bank);
+        free(R.out);
+        return NULL;
+    }
+    for (uint32_t r = 0; r < R.rows; r++) resample_build_row(&R, r, RESAMPLE_CUTOFF / ratio);
+
+    uint64_t chunks = (R.outFrames + RESAMPLE_CHUNK_FRAMES - 1) / RESAMPLE_CHUNK_FRAMES;
+    run_load_workers(resample_worker, &R, threads, chunks);
+
+    free(R.bank);
+    *outFrames = R.outFrames;
+    return R.out;
+}
+
+// ---------------- Parallel MP3 decode ----------------
+// An MP3 frame decodes correctly anywhere in the stream once the decoder has
+// been through the frames just before it: the bit reservoir reaches back at
+// most 511 bytes, and the MDCT overlap and synthesis filter carry over a
+// single granule. A first pass walks the stream with a NULL output, which does
+// all of minimp3's sync, header and reservoir bookkeeping but no synthesis,
+// and records every decode call with the frames it yields. Runs of those calls
+// are then decoded on load workers, each replaying a few calls before its run
+// to rebuild that state and writing straight into its slice of the buffer.
+// Encoder delay and padding are trimmed as ma_decoder does, so the output is
+// the same, sample for sample, as decoding serially. Streams the pass can't
+// vouch for (channel count or rate changing midway, a run yielding other than
+// planned) are left to ma_decoder.
+
+#define MP3_SEGMENT_CALLS 1024u // decode calls per work item, ~27 s at 44.1 kHz
+#define MP3_WARMUP_CALLS  3u    // a run is preceded by at least this many calls...
+#define MP3_WARMUP_BYTES  2048u // ...spanning at least this much of the stream
+
+typedef struct {
+    uint64_t pos;    // stream offset the call starts at
+    uint32_t frames; // PCM frames it yields, 0 when it only skips data
+} Mp3Call;
+
+typedef struct {
+    const uint8_t* data; // whole file
+    uint64_t end;        // stream end, before any trailing ID3v1/APE tag
+    Mp3Call* calls;
+    uint64_t callCount;
+    uint64_t* segFrame;  // per run: frames yielded by all calls before it
+    uint64_t segments;
+    uint32_t channels;   // 1 or 2, the same in every frame
+    uint32_t sampleRate;
+    uint64_t skip;       // encoder delay dropped from the front
+    uint64_t outFrames;  // frames kept after delay and padding
+    int16_t* out;        // interleaved stereo, outFrames long
+    _Atomic uint64_t nextSegment;
+    atomic_int failed;
+} Mp3Job;
+
+static int mp3_span(uint64_t bytes)
+{
+    return bytes > INT_MAX ? INT_MAX : (int)bytes;
+}
+
+// Whole-file view of a probed file: mapped where possible, else read in.
+static const uint8_t* probe_bytes(const FileProbe* p)
+{
+    if (p->size == 0 || p->size > SIZE_MAX) return NULL;
+#ifndef _WIN32
+    void* m = mmap(NULL, (size_t)p->size, PROT_READ, MAP_PRIVATE, fileno(p->file), 0);
+    return m == MAP_FAILED ? NULL : (const uint8_t*)m;
+#else
+    uint8_t* b = (uint8_t*)malloc((size_t)p->size);
+    if (!b) return NULL;
+    rewind(p->file);
+    if (fread(b, 1, (size_t)p->size, p->file) != (size_t)p->size) {
+        free(b);
+        return NULL;
+    }
+    return b;
+#endif
+}
+
+static void probe_bytes_release(const FileProbe* p, const uint8_t* b)
+{
+#ifndef _WIN32
+    munmap((void*)b, (size_t)p->size);
+#else
+    (void)p;
+    free((void*)b);
+#endif
+}
+
+// First pass: record every decode call from `start` on. Returns 0 if the
+// stream holds no audio, changes format midway, or memory runs out.
+static int mp3_scan(Mp3Job* J, uint64_t start)
+{
+    ma_dr_mp3dec dec;
+    ma_dr_mp3dec_init(&dec);
+    uint64_t cap = (J->end - start) / 256 + 64;
+    J->calls = (Mp3Call*)malloc((size_t)cap * sizeof(Mp3Call));
+    if (!J->calls) return 0;
+
+    uint64_t frames = 0;
+    for (uint64_t pos = start; pos < J->end;) {
+        ma_dr_mp3dec_frame_info info;
+        int got = ma_dr_mp3dec_decode_frame(&dec, J->data + pos, mp3_span(J->end - pos), NULL, &info);
+        if (info.frame_bytes <= 0) break;
+        if (got > 0) {
+            if (!J->channels) {
+                J->channels = (uint32_t)info.channels;
+                J->sampleRate = (uint32_t)info.sample_rate;
+            } else if ((uint32_t)info.channels != J->channels ||
+                       (uint32_t)info.sample_rate != J->sampleRate) {
+                return 0;
+            }
+        }
+        if (J->callCount == cap) {
+            Mp3Call* grown = (Mp3Call*)realloc(J->calls, (size_t)cap * 2 * sizeof(Mp3Call));
+            if (!grown) return 0;
+            J->calls = grown;
+            cap *= 2;
+        }
+        J->calls[J->callCount].pos = pos;
+        J->calls[J->callCount].frames = got > 0 ? (uint32_t)got : 0;
+        J->callCount++;
+        frames += got > 0 ? (uint64_t)got : 0;
+        pos += (uint64_t)info.frame_bytes;
+    }
+    if (frames == 0) return 0;
+
+    J->segments = (J->callCount + MP3_SEGMENT_CALLS - 1) / MP3_SEGMENT_CALLS;
+    J->segFrame = (uint64_t*)malloc((size_t)J->segments * sizeof(uint64_t));
+    if (!J->segFrame) return 0;
+    uint64_t at = 0;
+    for (uint64_t c = 0; c < J->callCount; c++) {
+        if (c % MP3_SEGMENT_CALLS == 0) J->segFrame[c / MP3_SEGMENT_CALLS] = at;
+        at += J->calls[c].frames;
+    }
+    return 1;
+}
+
+// Copies the part of n frames yielded at stream frame `at` that survives the
+// delay and padding trim into the output, as stereo.
+static void mp3_store(Mp3Job* J, uint64_t at, const int16_t* pcm, uint32_t n)
+{
+    uint64_t lo = at > J->skip ? at : J->skip;
+    uint64_t hi = at + n < J->skip + J->outFrames ? at + n : J->skip + J->outFrames;
+    if (lo >= hi) return;
+
+    const int16_t* src = pcm + (lo - at) * J->channels;
+    int16_t* dst = J->out + (lo - J->skip) * 2;
+    size_t count = (size_t)(hi - lo);
+    if (J->channels == 2) {
+        memcpy(dst, src, count * 2 * sizeof(int16_t));
+    } else {
+        for (size_t i = 0; i < count; i++) dst[i * 2] = dst[i * 2 + 1] = src[i];
+    }
+}
+
+static ma_thread_result MA_THREADCALL mp3_worker(void* arg)
+{
+    Mp3Job* J = (Mp3Job*)arg;
+    int16_t pcm[MA_DR_MP3_MAX_SAMPLES_PER_FRAME];
+    for (;;) {
+        uint64_t s = atomic_fetch_add(&J->nextSegment, 1);
+        if (s >= J->segments || atomic_load(&J->failed)) break;
+
+        uint64_t c0 = s * MP3_SEGMENT_CALLS;
+        uint64_t c1 = c0 + MP3_SEGMENT_CALLS < J->callCount ? c0 + MP3_SEGMENT_CALLS : J->callCount;
+        uint64_t c = c0;
+        while (c > 0 && (c0 - c < MP3_WARMUP_CALLS ||
+                         J->calls[c0].pos - J->calls[c].pos < MP3_WARMUP_BYTES)) {
+            c--;
+        }
+
+        ma_dr_mp3dec dec;
+        ma_dr_mp3dec_init(&dec);
+        uint64_t at = J->segFrame[s];
+        for (; c < c1; c++) {
+            ma_dr_mp3dec_frame_info info;
+            uint64_t pos = J->calls[c].pos;
+            int got = ma_dr_mp3dec_decode_frame(&dec, J->data + pos, mp3_span(J->end - pos), pcm, &info);
+            if (c < c0) continue; // warm-up, yields whatever it yields
+            if ((uint32_t)(got > 0 ? got : 0) != J->calls[c].frames) {
+                atomic_store(&J->failed, 1);
+                break;
+            }
+            mp3_store(J, at, pcm, J->calls[c].frames);
+            at += J->calls[c].frames;
+        }
+    }
+    return (ma_thread_result)0;
+}
+
+// Decodes a whole MP3 to interleaved s16 stereo at its own rate on `threads`
+// load workers. Returns 0, having freed everything, when the stream should go
+// through ma_decoder instead.
+static int mp3_decode_whole(const FileProbe* p, int threads,
+                            int16_t** pcm, uint64_t* frames, uint32_t* sampleRate)
+{
+    const uint8_t* data = probe_bytes(p);
+    if (!data) return 0;
+
+    // Let dr_mp3 find the stream bounds and the encoder delay and padding the
+    // same way ma_decoder's backend does: past ID3v2 and a Xing/Info frame,
+    // short of trailing tags.
+    ma_dr_mp3 head;
+    if (!ma_dr_mp3_init_memory(&head, data, (size_t)p->size, NULL)) {
+        probe_bytes_release(p, data);
+        return 0;
+    }
+    Mp3Job J = {0};
+    J.data = data;
+    J.end = head.streamLength < p->size ? head.streamLength : p->size;
+    uint64_t start = head.streamStartOffset;
+    uint64_t delay = head.delayInPCMFrames;
+    uint64_t padding = head.paddingInPCMFrames;
+    uint64_t total = head.totalPCMFrameCount;
+    ma_dr_mp3_uninit(&head);
+
+    int ok = start < J.end && mp3_scan(&J, start);
+    if (ok) {
+        uint64_t stop = J.segFrame[J.segments - 1];
+        for (uint64_t c = (J.segments - 1) * MP3_SEGMENT_CALLS; c < J.callCount; c++) stop += J.calls[c].frames;
+        if (total != UINT64_MAX && total > padding && total - padding < stop) stop = total - padding;
+        J.skip = delay;
+        J.outFrames = stop > delay ? stop - delay : 0;
+        ok = J.outFrames > 0 && J.outFrames <= SIZE_MAX / (2 * sizeof(int16_t));
+    }
+    if (ok) {
+        J.out = (int16_t*)malloc((size_t)J.outFrames * 2 * sizeof(int16_t));
+        ok = J.out != NULL;
+    }
+    if (ok) {
+        run_load_workers(mp3_worker, &J, threads, J.segments);
+        ok = !atomic_load(&J.failed);
+    }
+
+    free(J.calls);
+    free(J.segFrame);
+    probe_bytes_release(p, data);
+    if (!ok) {
+        free(J.out);
+        return 0;
+    }
+    *pcm = J.out;
+    *frames = J.outFrames;
+    *sampleRate = J.sampleRate;
+    return 1;
+}
+
+#define LOAD_GROW_FRAMES  65536u // allocation when the decoder can't tell the length
+#define LOAD_SPILL_FRAMES 1024u  // probe read past a length hint that was exact
+
+// Decodes a probed file whole with one ma_decoder, converting to interleaved
+// s16 stereo at the file's own rate. The length hint sizes the buffer once and
+// frames are decoded straight into it. A hint that falls short (or is
+// missing) grows the buffer geometrically.
+static int decode_whole(const FileProbe* p, const char* path,
+                        int16_t** pcmOut, uint64_t* framesOut, uint32_t* sampleRate)
+{
+    ma_decoder dec;
+    FileVfs vfs;
+    ma_decoder_config cfg = ma_decoder_config_init(ma_format_s16, 2, 0); // 0: native rate
+    ma_result r = decoder_init_probed(p, &vfs, cfg, path, &dec);
+    if (r != MA_SUCCESS) {
+        fprintf(stderr, "ma_decoder_init failed (%d) for: %s\n", (int)r, path);
+        return 0;
+    }
+
+    ma_format srcFormat = ma_format_unknown;
+    ma_uint32 srcChannels = 0;
+    ma_uint32 srcSampleRate = dec.outputSampleRate;
+    ma_data_source_get_data_format(dec.pBackend, &srcFormat, &srcChannels, NULL, NULL, 0);
+    fprintf(stderr, "File format: encoding=%d, format=%d, channels=%u, sampleRate=%u\n",
+            (int)p->encoding, (int)srcFormat, srcChannels, srcSampleRate);
+
+    ma_uint64 hint = 0;
+    if (ma_decoder_get_length_in_pcm_frames(&dec, &hint) != MA_SUCCESS) hint = 0;
+    if (hint > SIZE_MAX / (2 * sizeof(int16_t))) hint = 0;
+
+    size_t capFrames = hint ? (size_t)hint : LOAD_GROW_FRAMES;
+    size_t usedFrames = 0;
+    int16_t* pcm = (int16_t*)malloc(capFrames * 2 * sizeof(int16_t));
+    if (!pcm && hint) { // a corrupt header can claim far more than it holds
+        capFrames = LOAD_GROW_FRAMES;
+        pcm = (int16_t*)malloc(capFrames * 2 * sizeof(int16_t));
+    }
+    if (!pcm) {
+        ma_decoder_uninit(&dec);
+        return 0;
+    }
+
+    for (;;) {
+        int16_t spill[LOAD_SPILL_FRAMES * 2];
+        int full = usedFrames == capFrames;
+        ma_uint64 want = full ? LOAD_SPILL_FRAMES : (ma_uint64)(capFrames - usedFrames);
+        ma_uint64 framesRead = 0;
+        r = ma_decoder_read_pcm_frames(&dec, full ? spill : pcm + usedFrames * 2, want, &framesRead);
+        if (r != MA_SUCCESS && r != MA_AT_END) {
+            fprintf(stderr, "ma_decoder_read_pcm_frames failed (%d) for: %s\n", (int)r, path);
+            free(pcm);
+            ma_decoder_uninit(&dec);
+            return 0;
+        }
+        if (framesRead == 0) break;
+
+        if (full) {
+            // The file runs past its hint (or had none): grow and keep the spill.
+            size_t newCap = capFrames * 2;
+            int16_t* newPcm = (int16_t*)realloc(pcm, newCap * 2 * sizeof(int16_t));
+            if (!newPcm) {
+                free(pcm);
+                ma_decoder_uninit(&dec);
+                return 0;
+            }
+            pcm = newPcm;
+            capFrames = newCap;
+            memcpy(pcm + usedFrames * 2, spill, (size_t)framesRead * 2 * sizeof(int16_t));
+        }
+        usedFrames += (size_t)framesRead;
+        if (r == MA_AT_END) break;
+    }
+
+    ma_decoder_uninit(&dec);
+
+    if (usedFrames == 0) {
+        free(pcm);
+        fprintf(stderr, "Decoded 0 frames for: %s\n", path);
+        return 0;
+    }
+    if (usedFrames < capFrames && srcSampleRate == ENGINE_SAMPLE_RATE) {
+        int16_t* fit = (int16_t*)realloc(pcm, usedFrames * 2 * sizeof(int16_t));
+        if (fit) pcm = fit;
+    }
+
+    *pcmOut = pcm;
+    *framesOut = (uint64_t)usedFrames;
+    *sampleRate = srcSampleRate;
+    return 1;
+}
+
+// Decodes a probed file whole, MP3 on the load workers and everything else
+// through decode_whole, then converts rates other than 48 kHz with
+// resample_s16_stereo.
+static int load_to_s16_stereo48k(const FileProbe* p, const char* path, BufferS16* out,
+                                 int sinc, int threads)
+{
+    memset(out, 0, sizeof(*out));
+
+    int16_t* pcm = NULL;
+    uint64_t frames = 0;
+    uint32_t srcSampleRate = 0;
+    int decoded = 0;
+    if (p->encoding == ma_encoding_format_mp3) {
+        decoded = mp3_decode_whole(p, threads, &pcm, &frames, &srcSampleRate);
+        if (!decoded) fprintf(stderr, "Parallel MP3 decode not possible, decoding serially: %s\n", path);
+    }
+    if (!decoded && !decode_whole(p, path, &pcm, &frames, &srcSampleRate)) return 0;
+
+    if (srcSampleRate != ENGINE_SAMPLE_RATE) {
+        uint64_t outFrames = 0;
+        int16_t* converted = resample_s16_stereo(pcm, frames, srcSampleRate, sinc, threads, &outFrames);
+        free(pcm);
+        if (!converted) {
+            fprintf(stderr, "Out of memory resampling: %s\n", path);
+            return 0;
+        }
+        pcm = converted;
+        frames = outFrames;
+    }
+
+    out->pcm = pcm;
+    out->frames = frames;
+    out->channels = 2;
+    out->sampleRate = 48000;
+
+    fprintf(stderr, "Loaded OK: %s | frames=%llu | sr=48000 | ch=2\n",
+            path, (unsigned long long)out->frames);
+
+    return 1;
+}
+
+// ---------------- Decoded-PCM cache ----------------
+// Whatever load_to_s16_stereo48k produces is kept in a PcmCache (pcmcache.h)
+// keyed by the source file and the settings that shape the PCM, so the next
+// load of the same file maps the result instead of decoding it again. WAVs
+// that map_wav_s16_stereo48k plays in place never go through it.
+
+// Bump whenever decoding or resampling changes its output, so entries written
+// by an older build are ignored rather than played.
+#define CACHE_DECODE_REVISION 1u
+
+static int cache_key(PcmCache* c, const FileProbe* p, int sinc, PcmCacheKey* key)
+{
+    return c && pcm_cache_key(p->file, (CACHE_DECODE_REVISION << 1) | (sinc ? 1u : 0u), key);
+}
+
+// Fills `out` from a cached entry. buffer_free unmaps it like a mapped WAV.
+static int cache_load(PcmCache* c, const PcmCacheKey* key, const char* path, BufferS16* out)
+{
+    PcmCacheEntry hit;
+    if (!pcm_cache_map(c, key, &hit)) return 0;
+
+    memset(out, 0, sizeof(*out));
+    out->pcm = (int16_t*)hit.pcm;
+    out->frames = hit.frames;
+    out->channels = 2;
+    out->sampleRate = 48000;
+    out->map = hit.map;
+    out->mapLen = hit.mapLen;
+    buffer_set_direction(out, 0);
+
+    fprintf(stderr, "Cached OK: %s | frames=%llu | sr=48000 | ch=2\n",
+            path, (unsigned long long)out->frames);
+    return 1;
+}
+
+// ---------------- Streaming source ----------------
+// Long files are not decoded up front. A decoder thread keeps a bounded ring of
+// s16 stereo 48 kHz frames ahead of the play position and audio_cb only pops
+// from it, so memory stays constant and playback starts after one chunk.
+// Reverse playback seeks the decoder back window by window and reverses each
+// window before pushing it. The ring also holds on to the last
+// STREAM_KEEP_FRAMES played, so render-ahead can step back over audio it
+// rendered early without a seek.
+
+#define STREAM_MIN_FILE_BYTES  (64ull * 1024 * 1024) // smaller files are loaded whole
+#define STREAM_RING_FRAMES     (1u << 18)            // ~5.5 s at 48 kHz, power of two
+#define STREAM_KEEP_FRAMES     (1u << 17)            // of that, kept behind the play position
+#define STREAM_CHUNK_FRAMES    4096u                 // forward decode granularity
+#define STREAM_REVERSE_FRAMES  32768u                // reverse window, one seek each
+#define STREAM_SEEK_POINTS     4096u                 // MP3 seek table for reverse/seek
+#define STREAM_PREROLL_FRAMES  256u                  // settles the resampler after a seek
+
+typedef struct {
+    ma_decoder dec;
+    FileProbe probe;           // the file dec reads, taken over from the loader
+    FileVfs vfs;
+    ma_thread thread;
+    uint64_t frames;           // total length, 0 if the decoder can't tell
+
+    const atomic_int* reverse; // engine flags, read by the decoder thread
+    const atomic_int* loop;
+
+    int16_t* ring;             // STREAM_RING_FRAMES interleaved frames
+    int16_t* tmp;              // decoder thread scratch
+    _Atomic uint64_t writeIdx; // monotonic, advanced by the decoder thread
+    _Atomic uint64_t readIdx;  // advanced by audio_cb; render-ahead may step it back
+    _Atomic uint64_t keepIdx;  // monotonic, up to STREAM_KEEP_FRAMES behind readIdx;
+                               // the decoder never overwrites from here on
+
+    // Repositioning: the decoder thread publishes a new base position and
+    // direction, bumps flushGen and waits for audio_cb to drop the ring and
+    // echo the generation in ackGen.
+    _Atomic int64_t basePos;
+    atomic_int baseDir;
+    atomic_uint flushGen;
+    atomic_uint ackGen;
+    atomic_int eof;            // no more frames will be written until a flush
+
+    _Atomic int64_t seekReq;   // -1 or frame requested by the UI
+    _Atomic int64_t playPos;   // next frame audio_cb will play
+
+    // Consumer (audio thread) bookkeeping since the last flush.
+    int64_t curBase;
+    int curDir;
+    uint64_t consumed;
+
+    atomic_int quit;
+} StreamSource;
+
+static void stream_push(StreamSource* s, const int16_t* src, uint32_t frames)
+{
+    uint64_t w = atomic_load_explicit(&s->writeIdx, memory_order_relaxed);
+    uint32_t at = (uint32_t)(w & (STREAM_RING_FRAMES - 1));
+    uint32_t first = STREAM_RING_FRAMES - at;
+    if (first > frames) first = frames;
+
+    memcpy(s->ring + (size_t)at * 2, src, (size_t)first * 2 * sizeof(int16_t));
+    memcpy(s->ring, src + (size_t)first * 2, (size_t)(frames - first) * 2 * sizeof(int16_t));
+    atomic_store_explicit(&s->writeIdx, w + frames, memory_order_release);
+}
+
+// Drop everything buffered and restart at `at` going in `dir`. Blocks the
+// decoder thread until audio_cb has acknowledged; returns 0 on shutdown.
+static int stream_flush(StreamSource* s, int64_t at, int dir)
+{
+    atomic_store(&s->eof, 0);
+    atomic_store(&s->basePos, at);
+    atomic_store(&s->baseDir, dir);
+    unsigned gen = atomic_load(&s->flushGen) + 1;
+    atomic_store_explicit(&s->flushGen, gen, memory_order_release);
+
+    while (atomic_load_explicit(&s->ackGen, memory_order_acquire) != gen) {
+        if (atomic_load(&s->quit)) return 0;
+        ma_sleep(1);
+    }
+    return 1;
+}
+
+static uint32_t stream_fill_forward(StreamSource* s, uint64_t* pos)
+{
+    ma_uint64 got = 0;
+    ma_decoder_read_pcm_frames(&s->dec, s->tmp, STREAM_CHUNK_FRAMES, &got);
+    if (got == 0) {
+        if (atomic_load(s->loop)) {
+            ma_decoder_seek_to_pcm_frame(&s->dec, 0);
+            *pos = 0;
+            atomic_store(&s->eof, 0);
+        } else {
+            atomic_store(&s->eof, 1);
+        }
+        return 0;
+    }
+    stream_push(s, s->tmp, (uint32_t)got);
+    *pos += got;
+    return (uint32_t)got;
+}
+
+static uint32_t stream_fill_reverse(StreamSource* s, uint64_t* pos)
+{
+    if (*pos == 0) {
+        if (atomic_load(s->loop) && s->frames) {
+            *pos = s->frames;
+            atomic_store(&s->eof, 0);
+        } else {
+            atomic_store(&s->eof, 1);
+            return 0;
+        }
+    }
+
+    uint64_t n = (*pos < STREAM_REVERSE_FRAMES) ? *pos : STREAM_REVERSE_FRAMES;
+    uint64_t start = *pos - n;
+    uint64_t pre = (start < STREAM_PREROLL_FRAMES) ? start : STREAM_PREROLL_FRAMES;
+    ma_uint64 got = 0;
+    if (ma_decoder_seek_to_pcm_frame(&s->dec, start - pre) == MA_SUCCESS) {
+        ma_decoder_read_pcm_frames(&s->dec, s->tmp, pre + n, &got);
+    }
+    *pos = start;
+    if (got <= pre) return 0;
+    got -= pre;
+
+    // Frames are 2 x s16, so reversing the window is reversing uint32 words.
+    uint32_t* f = (uint32_t*)s->tmp + pre;
+    for (uint64_t i = 0, j = got - 1; i < j; i++, j--) {
+        uint32_t t = f[i]; f[i] = f[j]; f[j] = t;
+    }
+    stream_push(s, (const int16_t*)f, (uint32_t)got);
+    return (uint32_t)got;
+}
+
+static ma_thread_result MA_THREADCALL stream_thread(void* arg)
+{
+    StreamSource* s = (StreamSource*)arg;
+    int dir = 1;
+    uint64_t decPos = 0; // forward: next frame to decode; reverse: end of next window
+
+    while (!atomic_load(&s->quit)) {
+        int64_t seek = atomic_exchange(&s->seekReq, -1);
+        int want = atomic_load(s->reverse) ? -1 : 1;
+
+        if (seek >= 0 || want != dir) {
+            int64_t at = (seek >= 0) ? seek : atomic_load(&s->playPos);
+            if (!stream_flush(s, at, want)) break;
+            dir = want;
+            decPos = (dir > 0) ? (uint64_t)at : (uint64_t)at + 1;
+            if (s->frames && decPos > s->frames) decPos = s->frames;
+            if (dir > 0) ma_decoder_seek_to_pcm_frame(&s->dec, decPos);
+            continue;
+        }
+
+        uint64_t used = atomic_load_explicit(&s->writeIdx, memory_order_relaxed) -
+                        atomic_load_explicit(&s->keepIdx, memory_order_acquire);
+        uint32_t need = (dir > 0) ? STREAM_CHUNK_FRAMES : STREAM_REVERSE_FRAMES;
+        if (STREAM_RING_FRAMES - used < need) {
+            ma_sleep(2);
+            continue;
+        }
+
+        uint32_t got = (dir > 0) ? stream_fill_forward(s, &decPos)
+                                 : stream_fill_reverse(s, &decPos);
+        if (got == 0 && atomic_load(&s->eof)) ma_sleep(2);
+    }
+    return (ma_thread_result)0;
+}
+
+// Takes over p's file handle, also on failure.
+static StreamSource* stream_open(FileProbe* p, const char* path,
+                                 const atomic_int* reverse, const atomic_int* loop)
+{
+    StreamSource* s = (StreamSource*)calloc(1, sizeof(*s));
+    if (!s) {
+        probe_close(p);
+        return NULL;
+    }
+    s->probe = *p;
+    p->file = NULL;
+
+    ma_decoder_config cfg = ma_decoder_config_init(ma_format_s16, 2, 48000);
+    cfg.seekPointCount = STREAM_SEEK_POINTS;
+    ma_result r = decoder_init_probed(&s->probe, &s->vfs, cfg, path, &s->dec);
+    if (r != MA_SUCCESS) {
+        fprintf(stderr, "ma_decoder_init failed (%d) for: %s\n", (int)r, path);
+        probe_close(&s->probe);
+        free(s);
+        return NULL;
+    }
+
+    ma_uint64 len = 0;
+    if (ma_decoder_get_length_in_pcm_frames(&s->dec, &len) == MA_SUCCESS) s->frames = len;
+    ma_decoder_seek_to_pcm_frame(&s->dec, 0);
+
+    s->reverse = reverse;
+    s->loop = loop;
+    s->ring = (int16_t*)malloc((size_t)STREAM_RING_FRAMES * 2 * sizeof(int16_t));
+    s->tmp  = (int16_t*)malloc((size_t)(STREAM_PREROLL_FRAMES + STREAM_REVERSE_FRAMES) * 2 * sizeof(int16_t));
+    if (!s->ring || !s->tmp) goto fail;
+
+    atomic_store(&s->seekReq, -1);
+    atomic_store(&s->baseDir, 1);
+    s->curDir = 1;
+
+    if (ma_thread_create(&s->thread, ma_thread_priority_normal, 0, stream_thread, s, NULL) != MA_SUCCESS) {
+        fprintf(stderr, "Failed to start decoder thread for: %s\n", path);
+        goto fail;
+    }
+
+    fprintf(stderr, "Streaming: %s | frames=%llu | sr=48000 | ch=2\n",
+            path, (unsigned long long)s->frames);
+    return s;
+
+fail:
+    free(s->ring);
+    free(s->tmp);
+    ma_decoder_uninit(&s->dec);
+    probe_close(&s->probe);
+    free(s);
+    return NULL;
+}
+
+static void stream_close(StreamSource* s)
+{
+    if (!s) return;
+    atomic_store(&s->quit, 1);
+    ma_thread_wait(&s->thread);
+    ma_decoder_uninit(&s->dec);
+    probe_close(&s->probe);
+    free(s->ring);
+    free(s->tmp);
+    free(s);
+}
+
+// UI side: next frame to play will be `frame` (in the current direction).
+static void stream_seek(StreamSource* s, uint64_t frame)
+{
+    atomic_store(&s->seekReq, (int64_t)frame);
+}
+
+// Audio side: apply a pending flush from the decoder thread. Must run every
+// callback, playing or not, or a seek while paused would stall the decoder.
+static void stream_sync(StreamSource* s)
+{
+    unsigned gen = atomic_load_explicit(&s->flushGen, memory_order_acquire);
+    if (gen == atomic_load_explicit(&s->ackGen, memory_order_relaxed)) return;
+
+    atomic_store_explicit(&s->readIdx, atomic_load(&s->writeIdx), memory_order_release);
+    atomic_store_explicit(&s->keepIdx, atomic_load(&s->writeIdx), memory_order_release);
+    s->curBase = atomic_load(&s->basePos);
+    s->curDir = atomic_load(&s->baseDir);
+    s->consumed = 0;
+    atomic_store(&s->playPos, s->curBase);
+    atomic_store_explicit(&s->ackGen, gen, memory_order_release);
+}
+
+static void stream_update_pos(StreamSource* s)
+{
+    int64_t pos = s->curBase + (s->curDir > 0 ? (int64_t)s->consumed : -(int64_t)s->consumed);
+    if (s->frames) {
+        pos %= (int64_t)s->frames;
+        if (pos < 0) pos += (int64_t)s->frames;
+    }
+    atomic_store(&s->playPos, pos);
+}
+
+static uint32_t stream_read(StreamSource* s, int16_t* out, uint32_t outFrames)
+{
+    uint64_t r = atomic_load_explicit(&s->readIdx, memory_order_relaxed);
+    uint64_t avail = atomic_load_explicit(&s->writeIdx, memory_order_acquire) - r;
+    uint32_t n = (avail < outFrames) ? (uint32_t)avail : outFrames;
+    if (n == 0) return 0;
+
+    uint32_t at = (uint32_t)(r & (STREAM_RING_FRAMES - 1));
+    uint32_t first = STREAM_RING_FRAMES - at;
+    if (first > n) first = n;
+    memcpy(out, s->ring + (size_t)at * 2, (size_t)first * 2 * sizeof(int16_t));
+    memcpy(out + (size_t)first * 2, s->ring, (size_t)(n - first) * 2 * sizeof(int16_t));
+    atomic_store_explicit(&s->readIdx, r + n, memory_order_release);
+    if (r + n - atomic_load_explicit(&s->keepIdx, memory_order_relaxed) > STREAM_KEEP_FRAMES) {
+        atomic_store_explicit(&s->keepIdx, r + n - STREAM_KEEP_FRAMES, memory_order_release);
+    }
+
+    s->consumed += n;
+    stream_update_pos(s);
+    return n;
+}
+
+// Audio side: play again from ring index `idx`, `consumed` frames past the
+// last flush. The caller checks that no flush came in between and that idx
+// is at or after keepIdx.
+static void stream_rewind(StreamSource* s, uint64_t idx, uint64_t consumed)
+{
+    atomic_store_explicit(&s->readIdx, idx, memory_order_release);
+    s->consumed = consumed;
+    stream_update_pos(s);
+}
+
+// Audio side: true once the decoder hit the end (no loop) and the ring is drained.
+static int stream_at_end(StreamSource* s)
+{
+    return atomic_load(&s->eof) &&
+           atomic_load(&s->readIdx) == atomic_load(&s->writeIdx);
+}
+
+static int should_stream(const FileProbe* p)
+{
+    return p->size >= STREAM_MIN_FILE_BYTES;
+}
+
+// ---------------- Command queue ----------------
+// UI -> audio_cb control path. One producer (UI thread), one consumer (audio
+// thread), both ends wait-free. audio_cb drains it at the top of every block,
+// so every change lands on a block boundary and the audio thread never touches
+// state the UI is writing. New tracks arrive separately, see Engine.next.
+
+#define CMD_QUEUE_SIZE 256u // power of two
+
+typedef struct {
+    Cmd slots[CMD_QUEUE_SIZE];
+    _Alignas(64) _Atomic uint32_t head; // next slot to write, producer-owned
+    _Alignas(64) _Atomic uint32_t tail; // next slot to read, consumer-owned
+} CmdQueue;
+
+static int cmdq_push(CmdQueue* q, Cmd c)
+{
+    uint32_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t t = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (h - t == CMD_QUEUE_SIZE) return 0;
+
+    q->slots[h & (CMD_QUEUE_SIZE - 1)] = c;
+    atomic_store_explicit(&q->head, h + 1, memory_order_release);
+    return 1;
+}
+
+static int cmdq_pop(CmdQueue* q, Cmd* c)
+{
+    uint32_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t h = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (t == h) return 0;
+
+    *c = q->slots[t & (CMD_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&q->tail, t + 1, memory_order_release);
+    return 1;
+}
+
+// ---------------- Shared buffers ----------------
+// Decoded PCM is held once per file and load settings, however many voices
+// play it: 32 voices of one sample share one buffer, each with its own cursor
+// and sonic stream. The loader looks a file up before decoding it; tracks
+// hold a reference and the last one released frees the PCM (or unmaps it).
+// Lookups and releases happen on the loader and UI threads, never in audio_cb.
+
+typedef struct SharedBuffer {
+    BufferS16 buf;
+    char* path;
+    uint64_t size;        // identify the file version and how it was decoded
+    int64_t mtime;
+    int sinc;
+    int refs;             // guarded by BufferTable.lock
+    struct SharedBuffer* next;
+} SharedBuffer;
+
+typedef struct {
+    ma_mutex lock;
+    SharedBuffer* head;
+} BufferTable;
+
+static int64_t file_mtime(FILE* f)
+{
+    struct stat st;
+    return fstat(fileno(f), &st) == 0 ? (int64_t)st.st_mtime : -1;
+}
+
+// Returns the buffer already holding this version of `path`, with a new
+// reference, or NULL.
+static SharedBuffer* shared_find(BufferTable* bt, const char* path, const FileProbe* p, int sinc)
+{
+    int64_t mtime = file_mtime(p->file);
+    ma_mutex_lock(&bt->lock);
+    SharedBuffer* b = bt->head;
+    while (b && (b->size != p->size || b->mtime != mtime || b->sinc != sinc || strcmp(b->path, path) != 0)) {
+        b = b->next;
+    }
+    if (b) b->refs++;
+    ma_mutex_unlock(&bt->lock);
+    return b;
+}
+
+// Takes over `buf` and returns it as a shared buffer with one reference. On
+// failure `buf` is freed.
+static SharedBuffer* shared_add(BufferTable* bt, BufferS16* buf, const char* path, const FileProbe* p, int sinc)
+{
+    SharedBuffer* b = (SharedBuffer*)calloc(1, sizeof(*b));
+    char* name = (char*)malloc(strlen(path) + 1);
+    if (!b || !name) {
+        free(b);
+        free(name);
+        buffer_free(buf);
+        return NULL;
+    }
+    b->buf = *buf;
+    memset(buf, 0, sizeof(*buf));
+    b->path = strcpy(name, path);
+    b->size = p->size;
+    b->mtime = file_mtime(p->file);
+    b->sinc = sinc;
+    b->refs = 1;
+
+    ma_mutex_lock(&bt->lock);
+    b->next = bt->head;
+    bt->head = b;
+    ma_mutex_unlock(&bt->lock);
+    return b;
+}
+
+static void shared_release(BufferTable* bt, SharedBuffer* b)
+{
+    if (!b) return;
+    ma_mutex_lock(&bt->lock);
+    int last = --b->refs == 0;
+    if (last) {
+        SharedBuffer** link = &bt->head;
+        while (*link != b) link = &(*link)->next;
+        *link = b->next;
+    }
+    ma_mutex_unlock(&bt->lock);
+
+    if (last) {
+        buffer_free(&b->buf);
+        free(b->path);
+        free(b);
+    }
+}
+
+// ---------------- Mix bus ----------------
+// Voices after the first are rendered into a scratch block and summed into
+// the output as f32; the sum is clamped to full scale once per block when
+// more than one voice played. Plain branch-free loops over interleaved
+// samples, which the compiler turns into SIMD adds and min/max.
+
+static void mix_add(float* restrict out, const float* restrict in, size_t n)
+{
+    for (size_t i = 0; i < n; i++) out[i] += in[i];
+}
+
+static void mix_saturate(float* out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float v = out[i];
+        v = v > 1.0f ? 1.0f : v;
+        v = v < -1.0f ? -1.0f : v;
+        out[i] = v;
+    }
+}
+
+// ---------------- Parameter ramps ----------------
+// Tempo and volume changes glide linearly to the new value over a fixed
+// number of frames, so a slider move neither zips nor steps at block
+// boundaries, and sounds the same whatever the device period. A ramp that
+// has arrived costs nothing: render_voice then renders the block in one pass
+// as before, and gain_apply skips unity gain or runs one multiply.
+
+#define RAMP_TEMPO_FRAMES  2400u // 50 ms
+#define RAMP_VOLUME_FRAMES 480u  // 10 ms
+#define RAMP_TEMPO_CHUNK   64u   // frames rendered at one tempo while it glides
+
+typedef struct {
+    float value;          // now
+    float target;
+    float from;           // value when the glide began
+    float step;           // per frame
+    uint32_t pos, frames; // into the glide; pos == frames once it arrived
+} Ramp;
+
+static void ramp_set(Ramp* r, float to, uint32_t frames)
+{
+    r->target = to;
+    r->from = r->value;
+    r->step = frames ? (to - r->value) / (float)frames : 0.0f;
+    r->pos = 0;
+    r->frames = to == r->value ? 0 : frames;
+    if (r->frames == 0) r->value = to;
+}
+
+// Every value is computed from where the glide began, so the ramp comes out
+// the same however the frames are split into blocks.
+static void ramp_advance(Ramp* r, uint32_t frames)
+{
+    r->pos = frames < r->frames - r->pos ? r->pos + frames : r->frames;
+    r->value = r->pos == r->frames ? r->target : r->from + r->step * (float)r->pos;
+}
+
+// Scales interleaved stereo by the ramp, sample by sample while it glides
+// and by its settled value after. Both loops vectorize.
+static void gain_apply(Ramp* r, float* out, uint32_t frames)
+{
+    uint32_t left = r->frames - r->pos;
+    uint32_t n = frames < left ? frames : left;
+    float from = r->from, step = r->step;
+    int base = (int)r->pos + 1; // signed: converts to float in SIMD
+    for (int i = 0; i < (int)n; i++) {
+        float g = from + step * (float)(base + i);
+        out[i*2] *= g;
+        out[i*2 + 1] *= g;
+    }
+    ramp_advance(r, n);
+
+    float g = r->value;
+    if (g == 1.0f) return;
+    for (size_t i = (size_t)n * 2; i < (size_t)frames * 2; i++) out[i] *= g;
+}
+
+// ---------------- Engine ----------------
+// Everything needed to play one file on one voice. A loader thread builds it,
+// publishes it through Voice.next and the audio thread adopts it between
+// blocks. Tracks are only ever freed on the UI thread, once no callback can
+// still see them.
+typedef struct {
+    SharedBuffer* shared;  // in-memory or mapped PCM, possibly shared by other voices
+    const BufferS16* buf;  // &shared->buf, NULL for a stream
+    StreamSource* stream;  // set instead of buf for long files
+    sonicStream st;
+    uint64_t cursor;       // frame index (buffer tracks)
+    _Atomic uint64_t playPos; // cursor as of the last block, for the UI
+
+    // UI thread only: last readahead hints issued for a mapped buffer.
+    int hintReverse;
+    uint64_t hintPos;
+} Track;
+
+static void track_free(BufferTable* bt, Track* t)
+{
+    if (!t) return;
+    stream_close(t->stream);
+    shared_release(bt, t->shared);
+    if (t->st) sonicDestroyStream(t->st);
+    free(t);
+}
+
+static void track_seek(Track* t, uint64_t frame)
+{
+    uint64_t n = t->stream ? t->stream->frames : t->buf->frames;
+    if (n == 0) frame = 0;
+    else if (frame >= n) frame = n - 1;
+
+    if (t->stream) stream_seek(t->stream, frame);
+    else t->cursor = frame;
+}
+
+#define ENGINE_MAX_TRACKS      (ENGINE_MAX_VOICES * 4) // loaded but not yet freed
+#define ENGINE_FADE_BLOCK      2048  // crossfades are rendered in pieces of this
+#define ENGINE_MIN_TEMPO       0.1f  // render_track clamps to this; sizes sonic's output
+#define ENGINE_MAX_TEMPO       2.0f  // matches the UI slider; sizes the input scratch
+
+typedef struct {
+    ma_thread thread;
+    ma_mutex lock;
+    ma_event wake;
+    char path[ENGINE_MAX_VOICES][1024]; // guarded by lock
+    int hasRequest[ENGINE_MAX_VOICES];  // guarded by lock
+    int busy;                           // guarded by lock; a taken request isn't published yet
+    atomic_int quit;
+} Loader;
+
+// What one thread needs to render a voice. The callback thread and every
+// render worker have their own.
+typedef struct {
+    int16_t* dry;         // source frames on their way into sonic, Engine.dryFrames long
+    float fade[ENGINE_FADE_BLOCK * 2]; // the fading track's output
+} RenderScratch;
+
+// Render pool: with several voices playing, audio_cb fans their renders out
+// to pre-spawned worker threads and renders alongside them; see
+// engine_process_parallel. Each thread has a lane, a share of the block's
+// voices, and takes from other lanes once its own is empty. A lane is one
+// atomic word, generation << 32 | end << 16 | next job, claimed by CAS, so a
+// late worker can never claim a job from a newer block.
+#define RENDER_MAX_WORKERS   15    // besides the callback thread
+#define RENDER_DEADLINE      0.5   // share of a block's duration in which workers may start jobs
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t next;
+} RenderLane;
+
+typedef struct {
+    ma_thread thread;
+    ma_event wake;
+    atomic_int parked;    // set while waiting on wake, cleared by whoever signals it
+    int lane;             // 1 .. workers; lane 0 is the callback's
+    struct Engine* e;
+    RenderScratch scratch;
+} RenderWorker;
+
+typedef struct {
+    int workers;          // 0: every block renders inline
+    RenderWorker* worker;
+    float* voiceOut;      // one block of Engine.mixFrames per voice
+    atomic_int quit;
+
+    // The current block. Written by the callback before it stores the lanes
+    // and left alone until every job is done, so a thread holding a claimed
+    // job may read it.
+    _Atomic uint32_t generation;
+    uint32_t frameCount;
+    int jobCount;
+    uint8_t jobs[ENGINE_MAX_VOICES];      // voice indices
+    uint32_t produced[ENGINE_MAX_VOICES]; // per job, as render_voice returns
+    _Atomic double deadline;              // clock seconds
+    _Atomic int done;
+    RenderLane lanes[RENDER_MAX_WORKERS + 1];
+
+    // Counters, see EngineRenderStats.
+    _Atomic uint64_t blocks, jobsRun, steals, inlineJobs, lateBlocks, joinWaitNs, joinWaitMaxNs;
+} RenderPool;
+
+// Render-ahead (engine_set_render_ahead): a producer thread runs the graph a
+// few device periods ahead into a ring of period-sized slots and audio_cb only
+// copies out of it. Every slot is stamped with the invalidation count it was
+// rendered under, and audio_cb skips slots stamped older than the current
+// count. The producer also notes each voice's state as a slot began, so an
+// invalidation can put the voices back where the first discarded slot started.
+#define RENDER_AHEAD_MAX_MS  1000
+#define RENDER_AHEAD_GUARD   2     // slots an invalidation keeps: the one playing and the next
+#define RENDER_AHEAD_SPLICE  240   // frames (5 ms) from the discarded audio into its replacement
+
+// Where one of a voice's tracks stood as a slot began.
+typedef struct {
+    uint64_t pos;         // source frame its next output sample came from
+    uint64_t ringIdx;     // streams: that frame's index in the ring, if `inRing`
+    uint64_t consumed;    // streams: StreamSource.consumed there
+    unsigned gen;         // streams: the flush generation both belong to
+    int inRing;
+} AheadCursor;
+
+typedef struct {
+    Track* track;         // the voice's track as the slot began, NULL without one
+    Track* fading;
+    AheadCursor at, fadingAt;
+    uint32_t fadePos, fadeLen;
+    Ramp tempo, volume;
+    int audible;
+    int playing;
+} AheadVoice;
+
+typedef struct {
+    ma_thread thread;
+    atomic_int quit;
+    int running;          // fixed while the device runs
+    uint32_t chunk;       // frames per slot, the device period
+    uint32_t slots;       // ring length, a power of two
+    uint32_t target;      // slots to keep rendered ahead
+    float* pcm;           // slots * chunk interleaved frames
+    _Atomic uint32_t* stamp;  // per slot, the invalidation count it belongs to
+    AheadVoice* voices;   // ENGINE_MAX_VOICES per slot, producer only
+    float* seam;          // producer: the first discarded slot, to splice from
+    int seamPending;      // the next slot rendered starts with the splice
+
+    _Alignas(64) _Atomic uint32_t head;  // next slot to render, producer-owned
+    _Alignas(64) _Atomic uint32_t tail;  // slot being played, consumer-owned
+    uint32_t readOffset;  // consumer: frames of slot `tail` already played
+    _Atomic uint32_t epoch;              // invalidation count
+
+    // Counters, see EngineRenderStats.
+    _Atomic uint64_t underruns, invalidations;
+} RenderAhead;
+
+// Callback instrumentation, see EngineCallbackStats. Each block is counted by
+// the thread that produced it for the device (audio_cb, or engine_render
+// offline) with relaxed atomics, so the UI reads it without a lock. Starved
+// frames are also counted wherever a source ran dry, render workers included.
+typedef struct {
+    _Atomic uint64_t blocks, framesRequested, framesRendered, framesStarved;
+    _Atomic uint64_t underruns, lateBlocks, maxNs;
+    _Atomic uint32_t inputBacklog, outputBacklog, inputBacklogMax, outputBacklogMax;
+    _Atomic uint64_t timing[ENGINE_TIMING_BUCKETS];
+} CallbackStats;
+
+// One player: its current track, the track it is fading out from and its own
+// transport. Voice 0 is the deck the UI drives; any others are summed with it
+// on the mix bus.
+typedef struct {
+    // Track hand-off. The loader publishes into `next`; audio_cb takes it with
+    // an exchange and lists what it may touch in `live` (current, fading out).
+    _Atomic(Track*) next;
+    _Atomic(Track*) live[2];
+
+    // Audio thread only; changed while draining cmds.
+    Track* track;
+    Track* fading;        // previous track during a crossfade
+    uint32_t fadePos;
+    uint32_t fadeLen;     // fadeFrames when the fade began; later changes don't touch it
+    Ramp tempo;           // 0.5 .. 2.0
+    Ramp volume;          // 0 .. 1, applied after sonic by gain_apply
+    int audible;          // rendered since it last stopped; changes ramp from here on
+
+    // Written by the audio thread, read by the UI and decoder threads.
+    atomic_int playing;
+    atomic_int reverse;
+    atomic_int loop;
+} Voice;
+
+struct Engine {
+#ifndef MA_NO_DEVICE_IO
+    ma_device dev;
+#endif
+    CmdQueue cmds;        // UI -> audio
+    Voice voices[ENGINE_MAX_VOICES];
+
+    // `epoch` is odd while a callback runs. The UI frees a track only after it
+    // was unreferenced across a full callback boundary.
+    atomic_uint epoch;
+
+    // UI thread only: every track not yet freed, with its retire bookkeeping.
+    // The loader registers new tracks with a CAS on empty slots.
+    _Atomic(Track*) tracks[ENGINE_MAX_TRACKS];
+    int retiring[ENGINE_MAX_TRACKS];
+    unsigned retireEpoch[ENGINE_MAX_TRACKS];
+    Loader loader;
+    BufferTable buffers;
+
+    // Audio thread only.
+    uint32_t fadeFrames;  // crossfade length for every voice, 0 cuts
+    RenderScratch scratch;
+    uint32_t dryFrames;   // sized at device init, see engine_alloc_scratch
+    float* mix;           // one voice's output on its way to the mix bus
+    uint32_t mixFrames;
+    RenderPool pool;
+    int renderThreads;    // requested, see engine_set_render_threads
+    RenderAhead ahead;
+    uint32_t aheadMs;     // requested, see engine_set_render_ahead
+    CallbackStats stats;
+
+    int offline;          // set by engine_open_offline: never stream
+    atomic_int pitchFft;  // read by the loader in track_create
+    atomic_int resampleSinc; // likewise, see engine_set_resample
+    atomic_int loadThreads;
+    PcmCache* cache;      // NULL when off; fixed before the first load
+};
+
+// Monotonic seconds, cheap enough for the audio thread.
+static double clock_sec(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double)t.QuadPart / (double)f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void stat_add(_Atomic uint64_t* c, uint64_t n)
+{
+    atomic_fetch_add_explicit(c, n, memory_order_relaxed);
+}
+
+// Log-linear like an HDR histogram: exact below 16 ns, then 8 buckets per
+// power of two, so every bucket is within 12.5% of the times it counts.
+static int timing_bucket(uint64_t ns)
+{
+    if (ns < 16) return (int)ns;
+    int e = 4;
+    while ((ns >> (e + 1)) != 0) e++;
+    int b = 16 + (e - 4) * 8 + (int)((ns >> (e - 3)) & 7);
+    return b < ENGINE_TIMING_BUCKETS ? b : ENGINE_TIMING_BUCKETS - 1;
+}
+
+// Counts one block handed to the device: `rendered` of frameCount frames
+// came from playing voices, and `underrun` says a source ran dry in it.
+static void stats_block(CallbackStats* s, double t0, uint32_t frameCount, uint32_t rendered, int underrun)
+{
+    double dt = clock_sec() - t0;
+    uint64_t ns = dt > 0.0 ? (uint64_t)(dt * 1e9) : 0;
+    stat_add(&s->blocks, 1);
+    stat_add(&s->framesRequested, frameCount);
+    stat_add(&s->framesRendered, rendered);
+    stat_add(&s->timing[timing_bucket(ns)], 1);
+    if (underrun) stat_add(&s->underruns, 1);
+    if (dt * ENGINE_SAMPLE_RATE > (double)frameCount) stat_add(&s->lateBlocks, 1);
+    if (ns > atomic_load_explicit(&s->maxNs, memory_order_relaxed)) {
+        atomic_store_explicit(&s->maxNs, ns, memory_order_relaxed);
+    }
+}
+
+// What sonic holds across the voices just rendered: input it has not
+// processed yet and output not yet read.
+static void stats_backlog(Engine* e, const uint8_t* jobs, int jobCount)
+{
+    CallbackStats* s = &e->stats;
+    uint32_t in = 0, out = 0;
+    for (int j = 0; j < jobCount; j++) {
+        Track* t = e->voices[jobs[j]].track;
+        in += (uint32_t)sonicSamplesPending(t->st);
+        out += (uint32_t)sonicSamplesAvailable(t->st);
+    }
+    atomic_store_explicit(&s->inputBacklog, in, memory_order_relaxed);
+    atomic_store_explicit(&s->outputBacklog, out, memory_order_relaxed);
+    if (in > atomic_load_explicit(&s->inputBacklogMax, memory_order_relaxed)) {
+        atomic_store_explicit(&s->inputBacklogMax, in, memory_order_relaxed);
+    }
+    if (out > atomic_load_explicit(&s->outputBacklogMax, memory_order_relaxed)) {
+        atomic_store_explicit(&s->outputBacklogMax, out, memory_order_relaxed);
+    }
+}
+
+static uint32_t read_from_buffer(Voice* v, Track* t, int16_t* out, uint32_t outFrames)
+{
+    if (t->stream) return stream_read(t->stream, out, outFrames);
+
+    uint32_t got = frames_read(t->buf->pcm, t->buf->frames, &t->cursor,
+                               atomic_load(&v->reverse), atomic_load(&v->loop),
+                               out, outFrames);
+    atomic_store_explicit(&t->playPos, t->cursor, memory_order_relaxed);
+    return got;
+}
+
+static float cmd_volume(Cmd c)
+{
+    return c.f < 0.0f ? 0.0f : c.f > 1.0f ? 1.0f : c.f;
+}
+
+// Audio thread: apply one command from the UI.
+static void engine_apply(Engine* e, Cmd c)
+{
+    if (c.voice < 0 || c.voice >= ENGINE_MAX_VOICES) return;
+    Voice* v = &e->voices[c.voice];
+
+    switch (c.type) {
+    case CMD_SEEK:
+        if (v->track) track_seek(v->track, c.frame);
+        break;
+    case CMD_FLUSH:
+        if (v->track && v->track->st) sonicFlushStream(v->track->st);
+        break;
+    case CMD_SET_CROSSFADE: e->fadeFrames = (uint32_t)c.i; break;
+    case CMD_SET_PLAYING:
+        atomic_store(&v->playing, c.i);
+        if (!c.i) v->audible = 0;
+        break;
+    case CMD_SET_REVERSE:   atomic_store(&v->reverse, c.i); break;
+    case CMD_SET_LOOP:      atomic_store(&v->loop, c.i);    break;
+    case CMD_SET_TEMPO:
+        ramp_set(&v->tempo, c.f, v->audible ? RAMP_TEMPO_FRAMES : 0);
+        break;
+    case CMD_SET_VOLUME:
+        ramp_set(&v->volume, cmd_volume(c), v->audible ? RAMP_VOLUME_FRAMES : 0);
+        break;
+    }
+}
+
+// Audio thread: apply everything the UI queued since the last block.
+static void engine_apply_commands(Engine* e)
+{
+    Cmd c;
+    while (cmdq_pop(&e->cmds, &c)) engine_apply(e, c);
+}
+
+// Audio thread: adopt freshly loaded tracks. With crossfade enabled a voice's
+// old track keeps rendering underneath until the fade completes.
+static void engine_adopt_next(Engine* e)
+{
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        if (!atomic_load_explicit(&v->next, memory_order_relaxed)) continue;
+        Track* n = atomic_exchange(&v->next, NULL);
+        if (!n) continue;
+
+        Track* old = v->track;
+        v->fading = (old && e->fadeFrames && atomic_load(&v->playing)) ? old : NULL;
+        v->fadePos = 0;
+        v->fadeLen = e->fadeFrames;
+        v->track = n;
+        atomic_store(&v->live[0], n);
+        atomic_store(&v->live[1], v->fading);
+        atomic_store(&v->playing, 1);
+    }
+}
+
+// Runs one track through read_from_buffer -> sonic, feeding sonic only as
+// much input as it needs to produce frameCount frames at the voice's tempo.
+// Returns frames written; the remainder of `out` is zeroed. Sets *ended when
+// the source ran out.
+static uint32_t render_track(Engine* e, RenderScratch* s, Voice* v, Track* t,
+                             float* out, uint32_t frameCount, int* ended)
+{
+    float tempo = v->tempo.value;
+    if (tempo < ENGINE_MIN_TEMPO) tempo = ENGINE_MIN_TEMPO;
+    sonicSetSpeed(t->st, tempo);
+
+    *ended = 0;
+    uint32_t written = 0;
+    while (written < frameCount) {
+        int avail = sonicSamplesAvailable(t->st);
+        if (avail > 0) {
+            int gotOut = sonicReadFloatFromStream(t->st, out + (size_t)written * 2,
+                                                  (int)(frameCount - written));
+            if (gotOut <= 0) break;
+            written += (uint32_t)gotOut;
+            continue;
+        }
+
+        // Nothing buffered: pull the input the remaining output corresponds
+        // to. sonic holds back up to a couple of pitch periods, so the first
+        // pulls after a seek or flush may need another round.
+        uint32_t want = (uint32_t)((float)(frameCount - written) * tempo) + 1;
+        if (want > e->dryFrames) want = e->dryFrames;
+
+        uint32_t got = read_from_buffer(v, t, s->dry, want);
+        if (got == 0) {
+            // A streaming source that is merely behind (e.g. right after a
+            // seek) keeps playing; only a drained, finished source stops.
+            *ended = !t->stream || stream_at_end(t->stream);
+            break;
+        }
+        sonicWriteShortToStream(t->st, s->dry, (int)got);
+    }
+
+    if (written < frameCount) {
+        if (!*ended) stat_add(&e->stats.framesStarved, frameCount - written); // a stream fell behind
+        memset(out + (size_t)written * 2, 0, (size_t)(frameCount - written) * 2 * sizeof(float));
+    }
+    return written;
+}
+
+// Mixes the voice's fading track under `out` with a linear ramp, in
+// fixed-size pieces so the scratch buffer has a fixed size.
+static void engine_crossfade(Engine* e, RenderScratch* s, Voice* v, float* out, uint32_t frameCount)
+{
+    uint32_t done = 0;
+    while (v->fading && done < frameCount) {
+        uint32_t n = frameCount - done;
+        if (n > ENGINE_FADE_BLOCK) n = ENGINE_FADE_BLOCK;
+        if (n > v->fadeLen - v->fadePos) n = v->fadeLen - v->fadePos;
+
+        int ended = 0;
+        render_track(e, s, v, v->fading, s->fade, n, &ended);
+
+        float* o = out + (size_t)done * 2;
+        for (uint32_t i = 0; i < n; i++) {
+            float gIn = (float)(v->fadePos + i) / (float)v->fadeLen;
+            for (int c = 0; c < 2; c++) {
+                o[i*2 + c] = o[i*2 + c] * gIn + s->fade[i*2 + c] * (1.0f - gIn);
+            }
+        }
+
+        done += n;
+        v->fadePos += n;
+        if (ended || v->fadePos >= v->fadeLen) {
+            v->fading = NULL;
+            atomic_store(&v->live[1], NULL);
+        }
+    }
+}
+
+// One voice's block: its track plus any crossfade under it, at one tempo.
+// Returns the frames produced before the track ended, frameCount while it
+// plays on.
+static uint32_t render_voice_at(Engine* e, RenderScratch* s, Voice* v, float* out, uint32_t frameCount)
+{
+    int ended = 0;
+    uint32_t written = render_track(e, s, v, v->track, out, frameCount, &ended);
+    if (v->fading) engine_crossfade(e, s, v, out, frameCount);
+    if (ended && !v->fading) {
+        atomic_store(&v->playing, 0);
+        return written;
+    }
+    return frameCount;
+}
+
+// One voice's block through the gain stage. While the tempo glides the block
+// is rendered in RAMP_TEMPO_CHUNK pieces, each at the ramp's tempo there.
+static uint32_t render_voice(Engine* e, RenderScratch* s, Voice* v, float* out, uint32_t frameCount)
+{
+    uint32_t produced;
+    if (v->tempo.pos == v->tempo.frames) {
+        produced = render_voice_at(e, s, v, out, frameCount);
+    } else {
+        produced = 0;
+        while (produced < frameCount) {
+            uint32_t n = frameCount - produced;
+            uint32_t chunk = RAMP_TEMPO_CHUNK - v->tempo.pos % RAMP_TEMPO_CHUNK; // aligned to the glide
+            if (n > chunk) n = chunk;
+            uint32_t got = render_voice_at(e, s, v, out + (size_t)produced * 2, n);
+            ramp_advance(&v->tempo, n);
+            produced += got;
+            if (got < n) {
+                memset(out + (size_t)produced * 2, 0, (size_t)(frameCount - produced) * 2 * sizeof(float));
+                break;
+            }
+        }
+    }
+
+    gain_apply(&v->volume, out, produced);
+    v->audible = produced == frameCount;
+    if (!v->audible) {
+        // Stopped: the next start begins at the targets.
+        ramp_set(&v->tempo, v->tempo.target, 0);
+        ramp_set(&v->volume, v->volume.target, 0);
+    }
+    return produced;
+}
+
+// Set on the thread running engine_process, for engine_alloc_hook.
+static _Thread_local int tl_rendering;
+
+#ifndef NDEBUG
+// Debug builds: sonic streams are created real-time (see track_create), so
+// any allocation while a block renders is a sizing bug. Trap it.
+static void engine_alloc_hook(sonicStream st, long bytes)
+{
+    (void)st;
+    if (!tl_rendering) return;
+    fprintf(stderr, "sonic asked for %ld bytes on the audio thread\n", bytes);
+    abort();
+}
+
+// Debug builds: a NaN or inf in the mix would go out at full scale, or wrap
+// when written as integer PCM. Trap it before it leaves the engine.
+static void engine_check_block(const float* out, uint32_t frameCount)
+{
+    for (size_t i = 0; i < (size_t)frameCount * 2; i++) {
+        if (isfinite(out[i])) continue;
+        fprintf(stderr, "non-finite sample at frame %zu of a %u-frame block\n", i / 2, frameCount);
+        abort();
+    }
+}
+#endif
+
+// ---------------- Render pool ----------------
+
+// Pins the calling thread to `cpu` where the platform has hard affinity.
+static void pin_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+static int render_claim(RenderLane* l, uint32_t gen, uint32_t* job)
+{
+    uint64_t v = atomic_load_explicit(&l->next, memory_order_acquire);
+    for (;;) {
+        uint32_t next = (uint32_t)v & 0xFFFF, end = ((uint32_t)v >> 16) & 0xFFFF;
+        if ((uint32_t)(v >> 32) != gen || next >= end) return 0;
+        if (atomic_compare_exchange_weak_explicit(&l->next, &v, v + 1, memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            *job = next;
+            return 1;
+        }
+    }
+}
+
+// Renders jobs of block `gen` from lane `lane`, then from the others. Workers
+// start nothing past the deadline; the callback takes whatever is left, which
+// is the inline fallback when the pool is late.
+static void render_jobs(Engine* e, RenderScratch* s, int lane, uint32_t gen)
+{
+    RenderPool* p = &e->pool;
+    int lanes = p->workers + 1;
+    for (int k = 0; k < lanes; k++) {
+        int q = (lane + k) % lanes;
+        for (;;) {
+            int late = clock_sec() > atomic_load_explicit(&p->deadline, memory_order_relaxed);
+            if (late && lane != 0) return;
+
+            uint32_t job;
+            if (!render_claim(&p->lanes[q], gen, &job)) break;
+            if (k) atomic_fetch_add_explicit(&p->steals, 1, memory_order_relaxed);
+            if (late && q != 0) atomic_fetch_add_explicit(&p->inlineJobs, 1, memory_order_relaxed);
+
+            int voice = p->jobs[job];
+            float* out = p->voiceOut + (size_t)voice * e->mixFrames * 2;
+            p->produced[job] = render_voice(e, s, &e->voices[voice], out, p->frameCount);
+            atomic_fetch_add_explicit(&p->done, 1, memory_order_release);
+        }
+    }
+}
+
+static ma_thread_result MA_THREADCALL render_worker(void* arg)
+{
+    RenderWorker* w = (RenderWorker*)arg;
+    Engine* e = w->e;
+    RenderPool* p = &e->pool;
+    pin_thread(w->lane % cpu_count());
+    tl_rendering = 1;
+
+    uint32_t seen = atomic_load(&p->generation);
+    for (;;) {
+        // Park unless a block arrived since the last one; the callback clears
+        // `parked` and signals, so a block published in between is not missed.
+        atomic_store(&w->parked, 1);
+        if (atomic_load(&p->generation) == seen && !atomic_load(&p->quit)) ma_event_wait(&w->wake);
+        atomic_store(&w->parked, 0);
+        if (atomic_load(&p->quit)) break;
+
+        uint32_t gen = atomic_load_explicit(&p->generation, memory_order_acquire);
+        if (gen == seen) continue;
+        seen = gen;
+        render_jobs(e, &w->scratch, w->lane, gen);
+    }
+    return (ma_thread_result)0;
+}
+
+static void render_pool_stop(Engine* e)
+{
+    RenderPool* p = &e->pool;
+    atomic_store(&p->quit, 1);
+    for (int i = 0; i < p->workers; i++) {
+        ma_event_signal(&p->worker[i].wake);
+        ma_thread_wait(&p->worker[i].thread);
+        ma_event_uninit(&p->worker[i].wake);
+        free(p->worker[i].scratch.dry);
+    }
+    free(p->worker);
+    free(p->voiceOut);
+    p->worker = NULL;
+    p->voiceOut = NULL;
+    p->workers = 0;
+}
+
+// Starts engine_set_render_threads - 1 workers once the scratch is sized. With
+// one thread, or if anything fails, every block renders inline.
+static void render_pool_start(Engine* e)
+{
+    RenderPool* p = &e->pool;
+    int threads = e->renderThreads > 0 ? e->renderThreads : cpu_count();
+    int workers = threads - 1;
+    if (workers > RENDER_MAX_WORKERS) workers = RENDER_MAX_WORKERS;
+    if (workers <= 0) return;
+
+    p->voiceOut = (float*)malloc((size_t)ENGINE_MAX_VOICES * e->mixFrames * 2 * sizeof(float));
+    p->worker = (RenderWorker*)calloc((size_t)workers, sizeof(*p->worker));
+    if (!p->voiceOut || !p->worker) {
+        render_pool_stop(e);
+        return;
+    }
+    for (int i = 0; i < workers; i++) {
+        RenderWorker* w = &p->worker[i];
+        w->e = e;
+        w->lane = i + 1;
+        w->scratch.dry = (int16_t*)malloc((size_t)e->dryFrames * 2 * sizeof(int16_t));
+        if (!w->scratch.dry || ma_event_init(&w->wake) != MA_SUCCESS) {
+            free(w->scratch.dry);
+            break;
+        }
+        if (ma_thread_create(&w->thread, ma_thread_priority_realtime, 0, render_worker, w, NULL) != MA_SUCCESS) {
+            ma_event_uninit(&w->wake);
+            free(w->scratch.dry);
+            break;
+        }
+        p->workers++;
+    }
+    if (p->workers < workers) fprintf(stderr, "Started %d of %d render workers\n", p->workers, workers);
+}
+
+// Renders the playing voices `jobs` on the pool and mixes them in voice order,
+// which gives exactly the samples of the inline path. The callback renders
+// its own lane and steals, then waits only for jobs already running.
+static uint32_t engine_process_parallel(Engine* e, float* out, uint32_t frameCount,
+                                        const uint8_t* jobs, int jobCount)
+{
+    RenderPool* p = &e->pool;
+    uint32_t gen = atomic_load_explicit(&p->generation, memory_order_relaxed) + 1;
+    double start = clock_sec();
+    double deadline = start + RENDER_DEADLINE * (double)frameCount / ENGINE_SAMPLE_RATE;
+
+    p->frameCount = frameCount;
+    p->jobCount = jobCount;
+    memcpy(p->jobs, jobs, (size_t)jobCount);
+    atomic_store_explicit(&p->deadline, deadline, memory_order_relaxed);
+    atomic_store_explicit(&p->done, 0, memory_order_relaxed);
+    int lanes = p->workers + 1;
+    for (int q = 0; q < lanes; q++) {
+        // Rounded up, so the callback's own lane is never the empty one.
+        uint64_t first = (uint64_t)((jobCount * q + lanes - 1) / lanes);
+        uint64_t end = (uint64_t)((jobCount * (q + 1) + lanes - 1) / lanes);
+        atomic_store_explicit(&p->lanes[q].next, (uint64_t)gen << 32 | end << 16 | first, memory_order_release);
+    }
+    atomic_store(&p->generation, gen); // seq_cst against the worker's parked/generation check
+    for (int i = 0; i < p->workers; i++) {
+        if (atomic_exchange(&p->worker[i].parked, 0)) ma_event_signal(&p->worker[i].wake);
+    }
+
+    render_jobs(e, &e->scratch, 0, gen);
+
+    // Join: everything is claimed, some of it may still be rendering.
+    double now = clock_sec();
+    if (atomic_load_explicit(&p->done, memory_order_acquire) < jobCount) {
+        double waitFrom = now;
+        while (atomic_load_explicit(&p->done, memory_order_acquire) < jobCount) ma_yield();
+        now = clock_sec();
+        uint64_t ns = (uint64_t)((now - waitFrom) * 1e9);
+        atomic_fetch_add_explicit(&p->joinWaitNs, ns, memory_order_relaxed);
+        if (ns > atomic_load_explicit(&p->joinWaitMaxNs, memory_order_relaxed)) {
+            atomic_store_explicit(&p->joinWaitMaxNs, ns, memory_order_relaxed);
+        }
+    }
+    if (now > deadline) atomic_fetch_add_explicit(&p->lateBlocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->blocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->jobsRun, (uint64_t)jobCount, memory_order_relaxed);
+
+    uint32_t produced = 0;
+    for (int j = 0; j < jobCount; j++) {
+        const float* voiceOut = p->voiceOut + (size_t)jobs[j] * e->mixFrames * 2;
+        if (j == 0) memcpy(out, voiceOut, (size_t)frameCount * 2 * sizeof(float));
+        else mix_add(out, voiceOut, (size_t)p->produced[j] * 2);
+        if (p->produced[j] > produced) produced = p->produced[j];
+    }
+    mix_saturate(out, (size_t)frameCount * 2);
+    return produced;
+}
+
+// The voices' part of a block. Inline, the first playing voice renders
+// straight into `out` and the rest through the mix scratch onto the bus; with
+// a pool and more than one voice, see engine_process_parallel. Returns what
+// engine_render documents.
+static uint32_t engine_render_voices(Engine* e, float* out, uint32_t frameCount)
+{
+    uint8_t jobs[ENGINE_MAX_VOICES];
+    int jobCount = 0;
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        Track* t = v->track;
+        if (!t) continue;
+        if (t->stream) stream_sync(t->stream);
+        if (v->fading && v->fading->stream) stream_sync(v->fading->stream);
+        if (atomic_load(&v->playing) == 0 || (t->buf == NULL && t->stream == NULL)) continue;
+        jobs[jobCount++] = (uint8_t)i;
+    }
+
+    uint32_t produced = 0;
+    if (jobCount == 0) {
+        memset(out, 0, (size_t)frameCount * 2 * sizeof(float));
+    } else if (jobCount > 1 && e->pool.workers > 0 && frameCount <= e->mixFrames) {
+        produced = engine_process_parallel(e, out, frameCount, jobs, jobCount);
+    } else {
+        for (int j = 0; j < jobCount; j++) {
+            Voice* v = &e->voices[jobs[j]];
+            uint32_t got = 0;
+            if (j == 0) {
+                got = render_voice(e, &e->scratch, v, out, frameCount);
+            } else {
+                for (uint32_t done = 0; done < frameCount && atomic_load(&v->playing); ) {
+                    uint32_t n = frameCount - done;
+                    if (n > e->mixFrames) n = e->mixFrames;
+                    uint32_t r = render_voice(e, &e->scratch, v, e->mix, n);
+                    mix_add(out + (size_t)done * 2, e->mix, (size_t)r * 2);
+                    got = done + r;
+                    done += n;
+                }
+            }
+            if (got > produced) produced = got;
+        }
+        if (jobCount > 1) mix_saturate(out, (size_t)frameCount * 2); // one voice stays in range
+    }
+    stats_backlog(e, jobs, jobCount);
+#ifndef NDEBUG
+    engine_check_block(out, frameCount);
+#endif
+    return produced;
+}
+
+// One device block: the UI's changes, then the voices.
+static uint32_t engine_process(Engine* e, float* out, uint32_t frameCount)
+{
+    engine_apply_commands(e);
+    engine_adopt_next(e);
+    return engine_render_voices(e, out, frameCount);
+}
+
+// Sizes the sonic input scratch for one device period at the fastest tempo,
+// and the mix scratch for one period. Larger callbacks still work, they just
+// take more pulls and mix in pieces.
+static int engine_alloc_scratch(Engine* e, uint32_t periodFrames)
+{
+    uint32_t n = (uint32_t)((float)periodFrames * ENGINE_MAX_TEMPO) + 1;
+    if (n < ENGINE_FADE_BLOCK) n = ENGINE_FADE_BLOCK;
+    uint32_t m = periodFrames < ENGINE_FADE_BLOCK ? ENGINE_FADE_BLOCK : periodFrames;
+
+    e->scratch.dry = (int16_t*)malloc((size_t)n * 2 * sizeof(int16_t));
+    e->mix = (float*)malloc((size_t)m * 2 * sizeof(float));
+    if (!e->scratch.dry || !e->mix) return 0;
+    e->dryFrames = n;
+    e->mixFrames = m;
+    return 1;
+}
+
+// A block for the device, from audio_cb or engine_render: bracketed by
+// `epoch` for engine_collect and by tl_rendering for the allocation hook, and
+// counted in CallbackStats.
+static uint32_t engine_block(Engine* e, float* out, uint32_t frameCount)
+{
+    double t0 = clock_sec();
+    uint64_t starved = atomic_load_explicit(&e->stats.framesStarved, memory_order_relaxed);
+
+    atomic_fetch_add(&e->epoch, 1); // odd: tracks may be in use
+    tl_rendering = 1;
+    uint32_t n = engine_process(e, out, frameCount);
+    tl_rendering = 0;
+    atomic_fetch_add(&e->epoch, 1);
+
+    int underrun = atomic_load_explicit(&e->stats.framesStarved, memory_order_relaxed) != starved;
+    stats_block(&e->stats, t0, frameCount, n, underrun);
+    return n;
+}
+
+#ifndef MA_NO_DEVICE_IO
+// ---------------- Render-ahead ----------------
+// With engine_set_render_ahead the graph no longer runs in audio_cb: a
+// producer thread renders it one device period at a time into RenderAhead's
+// ring, up to the requested lead, and audio_cb copies out. The producer is the
+// audio thread as far as every other section is concerned: it drains the
+// command queue, adopts tracks and brackets `epoch`.
+//
+// Anything the UI changes would otherwise be heard only once the ring has
+// played out, so before applying commands or a new track the producer
+// invalidates: it keeps RENDER_AHEAD_GUARD slots past the play position, puts
+// every voice back the way it was as the next slot began (transport, ramps,
+// crossfade), clears sonic and renders on from there. Control latency stays at
+// a couple of periods whatever the lead. Where sonic restarts, the re-rendered
+// audio can't line up sample for sample with what it replaces, so the first
+// new slot crossfades in from the discarded one over RENDER_AHEAD_SPLICE
+// frames. Commands that would change nothing, a control sent again at its
+// current value, are applied without invalidating.
+
+// Frames of the track's source that sonic holds, input and output alike.
+static int64_t track_held(Track* t)
+{
+    return sonicSamplesPending(t->st) +
+           (int64_t)((float)sonicSamplesAvailable(t->st) * sonicGetSpeed(t->st));
+}
+
+// Where track `t` of voice `v` stands: the source frame its next output
+// sample comes from, and for a stream where that frame sits in the ring.
+static void track_note(Voice* v, Track* t, AheadCursor* c)
+{
+    uint64_t n = t->stream ? t->stream->frames : t->buf->frames;
+    int64_t at = t->stream ? atomic_load(&t->stream->playPos) : (int64_t)t->cursor;
+    int64_t held = track_held(t);
+    at += atomic_load(&v->reverse) ? held : -held;
+
+    if (n == 0) {
+        at = at < 0 ? 0 : at;
+    } else if (atomic_load(&v->loop)) {
+        at %= (int64_t)n;
+        if (at < 0) at += (int64_t)n;
+    } else if (at < 0) {
+        at = 0;
+    } else if (at >= (int64_t)n) {
+        at = (int64_t)n - 1;
+    }
+    c->pos = (uint64_t)at;
+
+    StreamSource* s = t->stream;
+    c->inRing = s && (uint64_t)held <= s->consumed;
+    if (c->inRing) {
+        c->ringIdx = atomic_load_explicit(&s->readIdx, memory_order_relaxed) - (uint64_t)held;
+        c->consumed = s->consumed - (uint64_t)held;
+        c->gen = atomic_load_explicit(&s->ackGen, memory_order_relaxed);
+    }
+}
+
+// Puts track `t` back where `c` noted it. A stream steps back through its
+// ring while the audio is still there; otherwise the source seeks. A stream
+// with a seek under way is left to it.
+static void track_rewind(Track* t, const AheadCursor* c)
+{
+    StreamSource* s = t->stream;
+    if (s) {
+        if (atomic_load(&s->seekReq) >= 0 || atomic_load(&s->flushGen) != atomic_load(&s->ackGen)) return;
+    }
+    if (s && c->inRing && c->gen == atomic_load_explicit(&s->ackGen, memory_order_relaxed) &&
+        c->ringIdx >= atomic_load_explicit(&s->keepIdx, memory_order_relaxed)) {
+        stream_rewind(s, c->ringIdx, c->consumed);
+    } else {
+        track_seek(t, c->pos);
+    }
+    sonicClearStream(t->st);
+}
+
+// Producer: whether applying `c` now would change what the voices render.
+static int render_ahead_changes(Engine* e, Cmd c)
+{
+    if (c.voice < 0 || c.voice >= ENGINE_MAX_VOICES) return 0;
+    Voice* v = &e->voices[c.voice];
+    switch (c.type) {
+    case CMD_SET_CROSSFADE: return 0; // only fades that start later
+    case CMD_SET_PLAYING:   return atomic_load(&v->playing) != c.i || (!c.i && v->audible);
+    case CMD_SET_REVERSE:   return atomic_load(&v->reverse) != c.i;
+    case CMD_SET_LOOP:      return atomic_load(&v->loop) != c.i;
+    case CMD_SET_TEMPO:     return v->tempo.value != c.f || v->tempo.target != c.f;
+    case CMD_SET_VOLUME:    return v->volume.value != cmd_volume(c) || v->volume.target != cmd_volume(c);
+    default:                return 1;
+    }
+}
+
+// Producer: true if the commands queued before `cmdHead`, or a track the UI
+// loaded, would change what the voices render.
+static int render_ahead_dirty(Engine* e, uint32_t cmdHead)
+{
+    for (uint32_t i = atomic_load_explicit(&e->cmds.tail, memory_order_relaxed); i != cmdHead; i++) {
+        if (render_ahead_changes(e, e->cmds.slots[i & (CMD_QUEUE_SIZE - 1)])) return 1;
+    }
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        if (atomic_load_explicit(&e->voices[i].next, memory_order_relaxed)) return 1;
+    }
+    return 0;
+}
+
+// Producer: every voice's state as a slot begins.
+static void render_ahead_note(Engine* e, AheadVoice* slot)
+{
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        AheadVoice* s = &slot[i];
+        s->track = v->track;
+        s->fading = v->fading;
+        if (v->track) track_note(v, v->track, &s->at);
+        if (v->fading) track_note(v, v->fading, &s->fadingAt);
+        s->fadePos = v->fadePos;
+        s->fadeLen = v->fadeLen;
+        s->tempo = v->tempo;
+        s->volume = v->volume;
+        s->audible = v->audible;
+        s->playing = atomic_load(&v->playing);
+    }
+}
+
+// Producer: puts the voices back the way `slot` noted them. Voices whose
+// track changed since, or that were and are paused, are left alone. A
+// crossfade that has finished since stays finished: its outgoing track may
+// already be freed, and the splice covers the rest of it.
+static void render_ahead_rewind(Engine* e, const AheadVoice* slot)
+{
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        const AheadVoice* s = &slot[i];
+        if (!s->track || s->track != v->track) continue;
+        if (!s->playing && !atomic_load(&v->playing)) continue;
+        track_rewind(v->track, &s->at);
+        if (v->fading && v->fading == s->fading) {
+            track_rewind(v->fading, &s->fadingAt);
+            v->fadePos = s->fadePos;
+            v->fadeLen = s->fadeLen;
+        }
+        v->tempo = s->tempo;
+        v->volume = s->volume;
+        v->audible = s->audible;
+        atomic_store(&v->playing, s->playing);
+    }
+}
+
+// Producer: keeps the first RENDER_AHEAD_GUARD live slots past the play
+// position by restamping them with the next count, then publishes that count,
+// which makes audio_cb skip the rest. The voices go back to where the first
+// skipped slot began, and that slot's audio is kept to splice from.
+static void render_ahead_invalidate(Engine* e)
+{
+    RenderAhead* a = &e->ahead;
+    uint32_t epoch = atomic_load_explicit(&a->epoch, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+    uint32_t i = atomic_load_explicit(&a->tail, memory_order_acquire);
+
+    for (int kept = 0; i != head; i++) {
+        _Atomic uint32_t* stamp = &a->stamp[i & (a->slots - 1)];
+        if (atomic_load_explicit(stamp, memory_order_relaxed) != epoch) continue; // skipped already
+        if (kept == RENDER_AHEAD_GUARD) break;
+        atomic_store_explicit(stamp, epoch + 1, memory_order_relaxed);
+        kept++;
+    }
+    if (i != head) {
+        uint32_t k = i & (a->slots - 1);
+        if (!a->seamPending) memcpy(a->seam, a->pcm + (size_t)k * a->chunk * 2, (size_t)a->chunk * 2 * sizeof(float));
+        a->seamPending = 1;
+        render_ahead_rewind(e, a->voices + (size_t)k * ENGINE_MAX_VOICES);
+    }
+    atomic_store_explicit(&a->epoch, epoch + 1, memory_order_release);
+    atomic_fetch_add_explicit(&a->invalidations, 1, memory_order_relaxed);
+}
+
+// Producer: slots in [tail, head) audio_cb will still play.
+static uint32_t render_ahead_ready(RenderAhead* a, uint32_t tail, uint32_t head)
+{
+    uint32_t epoch = atomic_load_explicit(&a->epoch, memory_order_relaxed);
+    uint32_t n = 0;
+    for (uint32_t i = tail; i != head; i++) {
+        n += atomic_load_explicit(&a->stamp[i & (a->slots - 1)], memory_order_relaxed) == epoch;
+    }
+    return n;
+}
+
+// Producer: a stream that was just seeked, or whose decoder fell behind, has
+// nothing to read yet. Better to wait while the ring still has audio than to
+// render silence into it.
+static int render_ahead_stalled(Engine* e)
+{
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        StreamSource* s = v->track ? v->track->stream : NULL;
+        if (!s || !atomic_load(&v->playing)) continue;
+        stream_sync(s);
+        if (atomic_load(&s->seekReq) >= 0 || atomic_load(&s->flushGen) != atomic_load(&s->ackGen)) return 1;
+        if (atomic_load(&s->readIdx) == atomic_load(&s->writeIdx) && !atomic_load(&s->eof)) return 1;
+    }
+    return 0;
+}
+
+// Producer: fades the first slot rendered after an invalidation in from the
+// audio it replaces, so a sonic restart doesn't click.
+static void render_ahead_splice(RenderAhead* a, float* pcm)
+{
+    uint32_t n = a->chunk < RENDER_AHEAD_SPLICE ? a->chunk : RENDER_AHEAD_SPLICE;
+    for (uint32_t i = 0; i < n; i++) {
+        float g = (float)(i + 1) / (float)(n + 1);
+        pcm[i * 2]     = a->seam[i * 2]     + (pcm[i * 2]     - a->seam[i * 2])     * g;
+        pcm[i * 2 + 1] = a->seam[i * 2 + 1] + (pcm[i * 2 + 1] - a->seam[i * 2 + 1]) * g;
+    }
+    a->seamPending = 0;
+}
+
+static ma_thread_result MA_THREADCALL render_ahead_thread(void* arg)
+{
+    Engine* e = (Engine*)arg;
+    RenderAhead* a = &e->ahead;
+    tl_rendering = 1;
+
+    while (!atomic_load(&a->quit)) {
+        atomic_fetch_add(&e->epoch, 1); // odd: tracks may be in use
+        uint32_t cmdHead = atomic_load_explicit(&e->cmds.head, memory_order_acquire);
+        int dirty = render_ahead_dirty(e, cmdHead);
+        if (dirty) render_ahead_invalidate(e);
+        for (Cmd c; atomic_load_explicit(&e->cmds.tail, memory_order_relaxed) != cmdHead && cmdq_pop(&e->cmds, &c); ) {
+            engine_apply(e, c);
+        }
+        if (dirty) engine_adopt_next(e);
+
+        uint32_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+        uint32_t ready = render_ahead_ready(a, tail, head);
+        int idle = head - tail == a->slots || ready >= a->target ||
+                   (ready > 0 && render_ahead_stalled(e));
+        if (!idle) {
+            uint32_t k = head & (a->slots - 1);
+            render_ahead_note(e, a->voices + (size_t)k * ENGINE_MAX_VOICES);
+            atomic_store_explicit(&a->stamp[k], atomic_load_explicit(&a->epoch, memory_order_relaxed),
+                                  memory_order_relaxed);
+            float* pcm = a->pcm + (size_t)k * a->chunk * 2;
+            engine_render_voices(e, pcm, a->chunk);
+            if (a->seamPending) render_ahead_splice(a, pcm);
+            atomic_store_explicit(&a->head, head + 1, memory_order_release);
+        }
+        atomic_fetch_add(&e->epoch, 1);
+        if (idle) ma_sleep(1);
+    }
+    return (ma_thread_result)0;
+}
+
+static void render_ahead_stop(Engine* e)
+{
+    RenderAhead* a = &e->ahead;
+    if (a->running) {
+        atomic_store(&a->quit, 1);
+        ma_thread_wait(&a->thread);
+        a->running = 0;
+    }
+    free(a->pcm);
+    free((void*)a->stamp);
+    free(a->voices);
+    free(a->seam);
+    a->pcm = NULL;
+    a->stamp = NULL;
+    a->voices = NULL;
+    a->seam = NULL;
+    a->seamPending = 0;
+}
+
+// Starts the producer for slots of `chunk` frames once the scratch is sized.
+// If anything fails the callback renders every block itself.
+static void render_ahead_start(Engine* e, uint32_t chunk)
+{
+    RenderAhead* a = &e->ahead;
+    if (e->aheadMs == 0 || chunk == 0) return;
+
+    uint32_t frames = e->aheadMs * (ENGINE_SAMPLE_RATE / 1000);
+    a->chunk = chunk;
+    a->target = (frames + chunk - 1) / chunk;
+    a->slots = 1;
+    while (a->slots < 2 * a->target + RENDER_AHEAD_GUARD) a->slots <<= 1; // a lead, and what it replaces
+    a->pcm = (float*)malloc((size_t)a->slots * chunk * 2 * sizeof(float));
+    a->stamp = (_Atomic uint32_t*)calloc(a->slots, sizeof(*a->stamp));
+    a->voices = (AheadVoice*)calloc((size_t)a->slots * ENGINE_MAX_VOICES, sizeof(*a->voices));
+    a->seam = (float*)malloc((size_t)chunk * 2 * sizeof(float));
+    if (!a->pcm || !a->stamp || !a->voices || !a->seam ||
+        ma_thread_create(&a->thread, ma_thread_priority_highest, 0, render_ahead_thread, e, NULL) != MA_SUCCESS) {
+        fprintf(stderr, "Render-ahead unavailable, rendering in the callback\n");
+        render_ahead_stop(e);
+        return;
+    }
+    a->running = 1;
+}
+
+// audio_cb with render-ahead: copies the next frameCount frames out of the
+// ring, skipping slots an invalidation discarded, and plays silence for
+// whatever the producer has not rendered yet. Returns the frames copied.
+static uint32_t render_ahead_read(RenderAhead* a, float* out, uint32_t frameCount)
+{
+    uint32_t epoch = atomic_load_explicit(&a->epoch, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    uint32_t done = 0;
+
+    while (done < frameCount && tail != atomic_load_explicit(&a->head, memory_order_acquire)) {
+        uint32_t k = tail & (a->slots - 1);
+        uint32_t stamp = atomic_load_explicit(&a->stamp[k], memory_order_relaxed);
+        if ((int32_t)(stamp - epoch) >= 0) {
+            uint32_t n = a->chunk - a->readOffset;
+            if (n > frameCount - done) n = frameCount - done;
+            memcpy(out + (size_t)done * 2, a->pcm + ((size_t)k * a->chunk + a->readOffset) * 2,
+                   (size_t)n * 2 * sizeof(float));
+            done += n;
+            a->readOffset += n;
+            if (a->readOffset < a->chunk) break;
+        }
+        a->readOffset = 0;
+        atomic_store_explicit(&a->tail, ++tail, memory_order_release);
+    }
+
+    if (done < frameCount) {
+        memset(out + (size_t)done * 2, 0, (size_t)(frameCount - done) * 2 * sizeof(float));
+        atomic_fetch_add_explicit(&a->underruns, 1, memory_order_relaxed);
+    }
+    return done;
+}
+
+static void audio_cb(ma_device* d, void* outp, const void* inp, ma_uint32 frameCount)
+{
+    (void)inp;
+    Engine* e = (Engine*)d->pUserData;
+    float* out = (float*)outp;
+
+    if (!e) {
+        memset(out, 0, (size_t)frameCount * 2 * sizeof(float));
+        return;
+    }
+    if (!e->ahead.running) {
+        engine_block(e, out, frameCount);
+        return;
+    }
+
+    double t0 = clock_sec();
+    uint32_t n = render_ahead_read(&e->ahead, out, frameCount);
+    if (n < frameCount) stat_add(&e->stats.framesStarved, frameCount - n);
+    stats_block(&e->stats, t0, frameCount, n, n < frameCount);
+}
+
+int engine_open_device(Engine* e)
+{
+    ma_device_config dc = ma_device_config_init(ma_device_type_playback);
+    dc.playback.format   = ma_format_f32;
+    dc.playback.channels = ENGINE_CHANNELS;
+    dc.sampleRate        = ENGINE_SAMPLE_RATE;
+    dc.dataCallback      = audio_cb;
+    dc.pUserData         = e;
+
+    if (ma_device_init(NULL, &dc, &e->dev) != MA_SUCCESS) {
+        fprintf(stderr, "ma_device_init failed\n");
+        return 0;
+    }
+    if (!engine_alloc_scratch(e, e->dev.playback.internalPeriodSizeInFrames)) {
+        fprintf(stderr, "Failed to allocate audio scratch\n");
+        ma_device_uninit(&e->dev);
+        return 0;
+    }
+    render_pool_start(e);
+    render_ahead_start(e, e->dev.playback.internalPeriodSizeInFrames);
+    if (ma_device_start(&e->dev) != MA_SUCCESS) {
+        fprintf(stderr, "ma_device_start failed\n");
+        ma_device_uninit(&e->dev);
+        render_ahead_stop(e);
+        return 0;
+    }
+    return 1;
+}
+
+void engine_close_device(Engine* e)
+{
+    ma_device_uninit(&e->dev);
+    render_ahead_stop(e); // after the callback, before the pool it renders on
+}
+#endif
+
+int engine_open_offline(Engine* e, uint32_t blockFrames)
+{
+    e->offline = 1;
+    if (!engine_alloc_scratch(e, blockFrames)) {
+        fprintf(stderr, "Failed to allocate audio scratch\n");
+        return 0;
+    }
+    render_pool_start(e);
+    return 1;
+}
+
+// Same path as audio_cb, so engine_collect and the stats behave identically.
+uint32_t engine_render(Engine* e, float* out, uint32_t frameCount)
+{
+    return engine_block(e, out, frameCount);
+}
+
+// UI thread: queue a command for the audio thread.
+int engine_send(Engine* e, Cmd c)
+{
+    if (!cmdq_push(&e->cmds, c)) {
+        fprintf(stderr, "Command queue full, dropped command %d\n", (int)c.type);
+        return 0;
+    }
+    return 1;
+}
+
+static int engine_references(Engine* e, Track* t)
+{
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        if (atomic_load(&v->next) == t ||
+            atomic_load(&v->live[0]) == t ||
+            atomic_load(&v->live[1]) == t) return 1;
+    }
+    return 0;
+}
+
+// UI thread: free tracks the audio thread can no longer reach. A track must be
+// unreferenced at two scans, and any callback running at the first one must
+// have finished before the second, since it may have just picked the track up.
+void engine_collect(Engine* e)
+{
+    unsigned epoch = atomic_load(&e->epoch); // before looking at references
+
+    for (int i = 0; i < ENGINE_MAX_TRACKS; i++) {
+        Track* t = atomic_load(&e->tracks[i]);
+        if (!t) continue;
+
+        if (engine_references(e, t)) {
+            e->retiring[i] = 0;
+            continue;
+        }
+        if (!e->retiring[i]) {
+            e->retiring[i] = 1;
+            e->retireEpoch[i] = epoch;
+            continue;
+        }
+        unsigned safe = (e->retireEpoch[i] | 1u) + 1u;
+        if ((int)(epoch - safe) >= 0) {
+            track_free(&e->buffers, t);
+            e->retiring[i] = 0;
+            atomic_store(&e->tracks[i], NULL);
+        }
+    }
+}
+
+// UI thread: keep readahead hints for the deck's mapped track in step with
+// the play direction and position. Safe because only this thread frees tracks.
+void engine_update_hints(Engine* e)
+{
+    Track* t = atomic_load(&e->voices[0].live[0]);
+    if (!t || !t->buf || !t->buf->map) return;
+
+    int rev = atomic_load(&e->voices[0].reverse);
+    uint64_t pos = atomic_load_explicit(&t->playPos, memory_order_relaxed);
+    uint64_t moved = (pos > t->hintPos) ? pos - t->hintPos : t->hintPos - pos;
+
+    if (rev != t->hintReverse) {
+        buffer_set_direction(t->buf, rev);
+        t->hintReverse = rev;
+        moved = UINT64_MAX;
+    }
+    if (moved >= MAP_REHINT_FRAMES) {
+        buffer_hint(t->buf, pos, rev);
+        t->hintPos = pos;
+    }
+}
+
+// Loader thread: build a track for voice `v` from `path`, sharing the PCM of
+// any track that already holds this file. Never touches the audio thread.
+static Track* track_create(Engine* e, Voice* v, const char* path)
+{
+    fprintf(stderr, "Attempting to load: %s\n", path);
+
+    FileProbe probe;
+    if (!probe_open(path, &probe)) {
+        fprintf(stderr, "Failed to open: %s\n", path);
+        return NULL;
+    }
+    Track* t = (Track*)calloc(1, sizeof(*t));
+    if (!t) {
+        probe_close(&probe);
+        return NULL;
+    }
+
+    int sinc = atomic_load(&e->resampleSinc);
+    BufferS16 buf = {0};
+    PcmCacheKey key;
+    int keyed = 0;
+    if ((t->shared = shared_find(&e->buffers, path, &probe, sinc)) != NULL) {
+        fprintf(stderr, "Shared OK: %s | frames=%llu\n", path, (unsigned long long)t->shared->buf.frames);
+    } else if (map_wav_s16_stereo48k(&probe, path, &buf)) {
+        // played in place
+    } else if ((keyed = cache_key(e->cache, &probe, sinc, &key)) &&
+               cache_load(e->cache, &key, path, &buf)) {
+        // decoded before, played in place from the cache
+    } else if (!e->offline && should_stream(&probe)) {
+        t->stream = stream_open(&probe, path, &v->reverse, &v->loop);
+        if (!t->stream) {
+            fprintf(stderr, "Failed to open stream\n");
+            track_free(&e->buffers, t);
+            return NULL;
+        }
+    } else {
+        if (!load_to_s16_stereo48k(&probe, path, &buf, sinc, atomic_load(&e->loadThreads))) {
+            fprintf(stderr, "Failed to load file\n");
+            probe_close(&probe);
+            track_free(&e->buffers, t);
+            return NULL;
+        }
+        fprintf(stderr, "Loaded %llu frames\n", (unsigned long long)buf.frames);
+        if (keyed && !pcm_cache_store(e->cache, &key, buf.pcm, buf.frames)) {
+            fprintf(stderr, "Could not cache: %s\n", path);
+        }
+    }
+    if (buf.pcm) t->shared = shared_add(&e->buffers, &buf, path, &probe, sinc);
+    probe_close(&probe);
+    if (!t->shared && !t->stream) {
+        track_free(&e->buffers, t);
+        return NULL;
+    }
+    if (t->shared) t->buf = &t->shared->buf;
+
+    t->cursor = 0;
+
+    // Real-time once the block size is known: sized for the largest write
+    // render_track makes (the dry scratch) and the slowest tempo, so sonic
+    // never allocates inside audio_cb. Faster tempos need no extra room.
+    if (e->dryFrames > 0) {
+        t->st = sonicCreateStreamRT(ENGINE_SAMPLE_RATE, ENGINE_CHANNELS, (int)e->dryFrames,
+                                    ENGINE_MIN_TEMPO, SONIC_MAX_SPEED);
+    } else {
+        t->st = sonicCreateStream(ENGINE_SAMPLE_RATE, ENGINE_CHANNELS);
+    }
+    if (!t->st) {
+        fprintf(stderr, "Failed to create sonic stream\n");
+        track_free(&e->buffers, t);
+        return NULL;
+    }
+    sonicSetQuality(t->st, 1);
+    if (atomic_load(&e->pitchFft) && !sonicSetPitchMethod(t->st, SONIC_PITCH_FFT)) {
+        fprintf(stderr, "FFT pitch search unavailable, using AMDF\n");
+    }
+    return t;
+}
+
+// Loader thread: make `t` the next track of voice `v` and record it for the
+// UI's collector. A previously published track that audio_cb never picked up
+// is simply left unreferenced and gets collected like any other.
+static void engine_publish(Engine* e, Voice* v, Track* t)
+{
+    atomic_store(&v->next, t);
+
+    for (;;) {
+        for (int i = 0; i < ENGINE_MAX_TRACKS; i++) {
+            Track* empty = NULL;
+            if (atomic_compare_exchange_strong(&e->tracks[i], &empty, t)) return;
+        }
+        if (atomic_load(&e->loader.quit)) return; // engine_shutdown frees it
+        ma_sleep(5);
+    }
+}
+
+static ma_thread_result MA_THREADCALL loader_thread(void* arg)
+{
+    Engine* e = (Engine*)arg;
+    Loader* l = &e->loader;
+    char path[sizeof(l->path[0])];
+
+    for (;;) {
+        ma_event_wait(&l->wake);
+        if (atomic_load(&l->quit)) break;
+
+        // One wake may stand for requests on several voices.
+        for (int voice = 0; voice < ENGINE_MAX_VOICES && !atomic_load(&l->quit); voice++) {
+            ma_mutex_lock(&l->lock);
+            int has = l->hasRequest[voice];
+            l->hasRequest[voice] = 0;
+            l->busy = has;
+            if (has) memcpy(path, l->path[voice], sizeof(path));
+            ma_mutex_unlock(&l->lock);
+            if (!has) continue;
+
+            Voice* v = &e->voices[voice];
+            Track* t = track_create(e, v, path);
+            if (t) {
+                engine_publish(e, v, t);
+                fprintf(stderr, "Engine load successful\n");
+            }
+            ma_mutex_lock(&l->lock);
+            l->busy = 0;
+            ma_mutex_unlock(&l->lock);
+        }
+    }
+    return (ma_thread_result)0;
+}
+
+// UI thread: ask the loader for `path` on `voice`. Returns immediately; the
+// voice's current track keeps playing until the new one is ready. A newer
+// request replaces an older one for the same voice that hasn't started yet.
+int engine_load_voice(Engine* e, int voice, const char* path)
+{
+    if (voice < 0 || voice >= ENGINE_MAX_VOICES) return 0;
+    Loader* l = &e->loader;
+    ma_mutex_lock(&l->lock);
+    strncpy(l->path[voice], path, sizeof(l->path[voice]) - 1);
+    l->path[voice][sizeof(l->path[voice]) - 1] = 0;
+    l->hasRequest[voice] = 1;
+    ma_mutex_unlock(&l->lock);
+    ma_event_signal(&l->wake);
+    return 1;
+}
+
+int engine_load(Engine* e, const char* path)
+{
+    return engine_load_voice(e, 0, path);
+}
+
+static int engine_start_loader(Engine* e)
+{
+    Loader* l = &e->loader;
+    if (ma_mutex_init(&e->buffers.lock) != MA_SUCCESS) return 0;
+    if (ma_mutex_init(&l->lock) != MA_SUCCESS) {
+        ma_mutex_uninit(&e->buffers.lock);
+        return 0;
+    }
+    if (ma_event_init(&l->wake) != MA_SUCCESS) {
+        ma_mutex_uninit(&l->lock);
+        ma_mutex_uninit(&e->buffers.lock);
+        return 0;
+    }
+    if (ma_thread_create(&l->thread, ma_thread_priority_normal, 0, loader_thread, e, NULL) != MA_SUCCESS) {
+        ma_event_uninit(&l->wake);
+        ma_mutex_uninit(&l->lock);
+        ma_mutex_uninit(&e->buffers.lock);
+        return 0;
+    }
+    return 1;
+}
+
+Engine* engine_create(void)
+{
+    Engine* e = (Engine*)calloc(1, sizeof(*e));
+    if (!e) return NULL;
+
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        atomic_store(&v->playing, 0);
+        atomic_store(&v->reverse, 0);
+        atomic_store(&v->loop, 1);
+        ramp_set(&v->tempo, 1.0f, 0);
+        ramp_set(&v->volume, 1.0f, 0);
+    }
+    atomic_store(&e->resampleSinc, 1);
+    e->fadeFrames = ENGINE_SAMPLE_RATE * ENGINE_CROSSFADE_MS / 1000;
+#ifndef NDEBUG
+    sonicSetAllocationHook(engine_alloc_hook);
+#endif
+
+    if (!engine_start_loader(e)) {
+        fprintf(stderr, "Failed to start loader thread\n");
+        pcm_cache_close(e->cache);
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+void engine_destroy(Engine* e)
+{
+    Loader* l = &e->loader;
+    atomic_store(&l->quit, 1);
+    ma_event_signal(&l->wake);
+    ma_thread_wait(&l->thread);
+    ma_event_uninit(&l->wake);
+    ma_mutex_uninit(&l->lock);
+    render_pool_stop(e);
+
+    // A track published while the loader was told to quit may be unregistered.
+    for (int v = 0; v < ENGINE_MAX_VOICES; v++) {
+        Track* n = atomic_exchange(&e->voices[v].next, NULL);
+        int nRegistered = 0;
+        for (int i = 0; n && i < ENGINE_MAX_TRACKS; i++) {
+            if (atomic_load(&e->tracks[i]) == n) nRegistered = 1;
+        }
+        if (n && !nRegistered) track_free(&e->buffers, n);
+    }
+    for (int i = 0; i < ENGINE_MAX_TRACKS; i++) {
+        track_free(&e->buffers, atomic_exchange(&e->tracks[i], NULL));
+    }
+    ma_mutex_uninit(&e->buffers.lock);
+
+    pcm_cache_close(e->cache);
+    free(e->scratch.dry);
+    free(e->mix);
+    free(e);
+}
+
+
+int engine_load_voice_now(Engine* e, int voice, const char* path)
+{
+    if (voice < 0 || voice >= ENGINE_MAX_VOICES) return 0;
+    Voice* v = &e->voices[voice];
+    Track* t = track_create(e, v, path);
+    if (!t) return 0;
+    engine_publish(e, v, t);
+    engine_adopt_next(e); // so commands sent next already apply to it
+    return 1;
+}
+
+int engine_load_now(Engine* e, const char* path)
+{
+    return engine_load_voice_now(e, 0, path);
+}
+
+void engine_set_pitch_method(Engine* e, int fft)
+{
+    atomic_store(&e->pitchFft, fft ? 1 : 0);
+}
+
+void engine_set_resample(Engine* e, int sinc, int threads)
+{
+    atomic_store(&e->resampleSinc, sinc ? 1 : 0);
+    atomic_store(&e->loadThreads, threads > 0 ? threads : 0);
+}
+
+void engine_set_render_threads(Engine* e, int threads)
+{
+    e->renderThreads = threads > 0 ? threads : 0;
+}
+
+void engine_set_render_ahead(Engine* e, uint32_t ms)
+{
+    e->aheadMs = ms > RENDER_AHEAD_MAX_MS ? RENDER_AHEAD_MAX_MS : ms;
+}
+
+void engine_render_stats(Engine* e, EngineRenderStats* out)
+{
+    RenderPool* p = &e->pool;
+    out->workers = p->workers;
+    out->blocks = atomic_load_explicit(&p->blocks, memory_order_relaxed);
+    out->jobs = atomic_load_explicit(&p->jobsRun, memory_order_relaxed);
+    out->steals = atomic_load_explicit(&p->steals, memory_order_relaxed);
+    out->inlineJobs = atomic_load_explicit(&p->inlineJobs, memory_order_relaxed);
+    out->lateBlocks = atomic_load_explicit(&p->lateBlocks, memory_order_relaxed);
+    out->joinWaitNs = atomic_load_explicit(&p->joinWaitNs, memory_order_relaxed);
+    out->joinWaitMaxNs = atomic_load_explicit(&p->joinWaitMaxNs, memory_order_relaxed);
+    out->aheadUnderruns = atomic_load_explicit(&e->ahead.underruns, memory_order_relaxed);
+    out->aheadInvalidations = atomic_load_explicit(&e->ahead.invalidations, memory_order_relaxed);
+}
+
+void engine_callback_stats(Engine* e, EngineCallbackStats* out)
+{
+    CallbackStats* s = &e->stats;
+    out->blocks = atomic_load_explicit(&s->blocks, memory_order_relaxed);
+    out->framesRequested = atomic_load_explicit(&s->framesRequested, memory_order_relaxed);
+    out->framesRendered = atomic_load_explicit(&s->framesRendered, memory_order_relaxed);
+    out->framesStarved = atomic_load_explicit(&s->framesStarved, memory_order_relaxed);
+    out->underruns = atomic_load_explicit(&s->underruns, memory_order_relaxed);
+    out->lateBlocks = atomic_load_explicit(&s->lateBlocks, memory_order_relaxed);
+    out->maxNs = atomic_load_explicit(&s->maxNs, memory_order_relaxed);
+    out->inputBacklog = atomic_load_explicit(&s->inputBacklog, memory_order_relaxed);
+    out->outputBacklog = atomic_load_explicit(&s->outputBacklog, memory_order_relaxed);
+    out->inputBacklogMax = atomic_load_explicit(&s->inputBacklogMax, memory_order_relaxed);
+    out->outputBacklogMax = atomic_load_explicit(&s->outputBacklogMax, memory_order_relaxed);
+    for (int i = 0; i < ENGINE_TIMING_BUCKETS; i++) {
+        out->timing[i] = atomic_load_explicit(&s->timing[i], memory_order_relaxed);
+    }
+}
+
+uint64_t engine_timing_bucket_ns(int i)
+{
+    if (i < 16) return (uint64_t)i;
+    int e = 4 + (i - 16) / 8;
+    uint64_t sub = (uint64_t)((i - 16) % 8);
+    return ((9 + sub) << (e - 3)) - 1;
+}
+
+uint64_t engine_timing_percentile(const EngineCallbackStats* s, double q)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < ENGINE_TIMING_BUCKETS; i++) total += s->timing[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < ENGINE_TIMING_BUCKETS; i++) {
+        seen += s->timing[i];
+        if (seen >= rank) {
+            uint64_t ns = engine_timing_bucket_ns(i);
+            return ns < s->maxNs ? ns : s->maxNs;
+        }
+    }
+    return s->maxNs;
+}
+
+int engine_set_cache(Engine* e, const char* dir, uint64_t maxBytes)
+{
+    pcm_cache_close(e->cache);
+    e->cache = dir ? pcm_cache_open(dir, maxBytes) : NULL;
+    return !dir || e->cache;
+}
+
+int engine_prewarm(Engine* e, const char* path)
+{
+    FileProbe probe;
+    if (!e->cache || !probe_open(path, &probe)) return -1;
+
+    int sinc = atomic_load(&e->resampleSinc);
+    int result = -1;
+    PcmCacheKey key;
+    PcmCacheEntry hit;
+    BufferS16 buf;
+    if (map_wav_s16_stereo48k(&probe, path, &buf)) {
+        buffer_free(&buf);
+        result = 0;
+    } else if (!cache_key(e->cache, &probe, sinc, &key)) {
+        fprintf(stderr, "Cannot read: %s\n", path);
+    } else if (pcm_cache_map(e->cache, &key, &hit)) {
+        pcm_cache_unmap(&hit);
+        result = 0;
+    } else if (load_to_s16_stereo48k(&probe, path, &buf, sinc, atomic_load(&e->loadThreads))) {
+        result = pcm_cache_store(e->cache, &key, buf.pcm, buf.frames) ? 1 : -1;
+        buffer_free(&buf);
+    }
+    probe_close(&probe);
+    return result;
+}
+
+int engine_playing(Engine* e) { return atomic_load(&e->voices[0].playing); }
+int engine_reverse(Engine* e) { return atomic_load(&e->voices[0].reverse); }
+int engine_loop(Engine* e)    { return atomic_load(&e->voices[0].loop); }
+
+// Only the UI thread frees tracks, so live[0] stays valid while we look.
+uint64_t engine_position(Engine* e)
+{
+    Track* t = atomic_load(&e->voices[0].live[0]);
+    if (!t) return 0;
+    if (t->stream) return (uint64_t)atomic_load(&t->stream->playPos);
+    return atomic_load_explicit(&t->playPos, memory_order_relaxed);
+}
+
+uint64_t engine_length(Engine* e)
+{
+    Track* t = atomic_load(&e->voices[0].live[0]);
+    if (!t) return 0;
+    return t->stream ? t->stream->frames : t->buf->frames;
+}
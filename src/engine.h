@@ -0,0 +1,153 @@
+// src/engine.h
+//
+// Playback engine: sources (in memory, mapped or streamed), the UI -> audio
+// command queue, voices each running a read_from_buffer -> sonic chain, the
+// mix bus summing them and the audio device. The raylib UI drives it live;
+// novaaudio_render drives the same graph offline, block by block, without a
+// device.
+
+#ifndef NOVA_ENGINE_H
+#define NOVA_ENGINE_H
+
+#include <stdint.h>
+
+#define ENGINE_SAMPLE_RATE   48000
+#define ENGINE_CHANNELS      2
+#define ENGINE_CROSSFADE_MS  250
+#define ENGINE_MAX_VOICES    64  // voice 0 is the deck the UI plays
+
+typedef enum {
+    CMD_SEEK,         // frame; UINT64_MAX means the last frame
+    CMD_FLUSH,        // push sonic's pending input through to its output
+    CMD_SET_CROSSFADE,// i = frames, 0 cuts straight to a new track
+    CMD_SET_PLAYING,  // i
+    CMD_SET_REVERSE,  // i
+    CMD_SET_LOOP,     // i
+    CMD_SET_TEMPO,    // f; glides there over 50 ms while the voice is heard
+    CMD_SET_VOLUME,   // f in [0, 1]; likewise over 10 ms
+} CmdType;
+
+// Every command but CMD_SET_CROSSFADE applies to one voice, 0 unless set.
+typedef struct {
+    CmdType type;
+    int voice;
+    union {
+        uint64_t frame;
+        int i;
+        float f;
+    };
+} Cmd;
+
+typedef struct Engine Engine;
+
+// Creates an idle engine (looping on, tempo and volume 1, crossfade on) and
+// starts its loader thread. NULL on failure.
+Engine* engine_create(void);
+// Stops the loader and frees every track. Close the device first.
+void engine_destroy(Engine* e);
+
+// Live playback: open and start the default device, sizing the audio scratch
+// from its period. Returns 0 on failure.
+int engine_open_device(Engine* e);
+void engine_close_device(Engine* e);
+
+// Offline playback: size the scratch for blocks of up to blockFrames and load
+// files whole instead of streaming them, so output never depends on timing.
+int engine_open_offline(Engine* e, uint32_t blockFrames);
+// Renders one block exactly as the device callback would. Returns the frames
+// produced before the last playing voice ended, frameCount while one plays
+// on, and 0 when all are stopped; the rest of `out` is silence. Samples are
+// interleaved f32 in [-1, 1], the format the device is opened with.
+uint32_t engine_render(Engine* e, float* out, uint32_t frameCount);
+// Loads `path` on the calling thread and makes it the current track of the
+// deck, or of `voice`. Offline only: no device may be running. Returns 0 on
+// failure.
+int engine_load_now(Engine* e, const char* path);
+int engine_load_voice_now(Engine* e, int voice, const char* path);
+
+// Pitch search for tracks loaded from now on: 0 = AMDF (default), 1 = FFT.
+// See sonicSetPitchMethod.
+void engine_set_pitch_method(Engine* e, int fft);
+// Files loaded whole from now on: non-48 kHz conversion by windowed sinc
+// (default) or linear, and `threads` threads (0: one per CPU) for that and
+// for decoding MP3. The output does not depend on the thread count.
+void engine_set_resample(Engine* e, int sinc, int threads);
+// Threads rendering voices, the audio callback's own included (0: one per
+// CPU, the default). With more than one, blocks with several voices playing
+// are rendered on a pool of pinned real-time workers; the output is the same
+// either way. Call before engine_open_device or engine_open_offline.
+void engine_set_render_threads(Engine* e, int threads);
+// Device only: render `ms` milliseconds (at most 1000) ahead of the callback
+// on a producer thread, leaving the callback a copy. Commands and new tracks
+// discard what was rendered past the next period or two and re-render it, so
+// they are heard as promptly as without. engine_position then runs ahead of
+// what is heard by up to `ms`. 0, the default, renders in the callback. Call
+// before engine_open_device.
+void engine_set_render_ahead(Engine* e, uint32_t ms);
+
+// Render pool and render-ahead counters, cumulative since the device opened.
+typedef struct {
+    int workers;            // threads besides the callback
+    uint64_t blocks;        // blocks rendered on the pool
+    uint64_t jobs;          // voice renders in those blocks
+    uint64_t steals;        // jobs a thread took from another thread's share
+    uint64_t inlineJobs;    // workers' jobs the callback rendered past the deadline
+    uint64_t lateBlocks;    // blocks whose voices were all done only past the deadline
+    uint64_t joinWaitNs;    // time the callback waited for jobs still running
+    uint64_t joinWaitMaxNs; // longest such wait in one block
+    uint64_t aheadUnderruns;     // callbacks render-ahead could not fill
+    uint64_t aheadInvalidations; // lead discarded for commands or new tracks
+} EngineRenderStats;
+void engine_render_stats(Engine* e, EngineRenderStats* out);
+
+// Callback instrumentation, cumulative since the device opened: every block
+// handed to the device, by audio_cb or by engine_render offline. Updated by
+// the audio thread without locks; any thread may read it at any time.
+#define ENGINE_TIMING_BUCKETS 272 // 8 per power of two, up to ~34 s
+typedef struct {
+    uint64_t blocks;
+    uint64_t framesRequested;
+    uint64_t framesRendered;  // frames from playing voices; the rest was silence
+    uint64_t framesStarved;   // zero-filled while playing: a stream behind, the render-ahead ring dry
+    uint64_t underruns;       // blocks the device got with starved frames in them
+    uint64_t lateBlocks;      // blocks that took longer than the audio in them
+    uint64_t maxNs;           // longest block
+    uint32_t inputBacklog;    // sonic input not yet processed, over the playing voices, last block
+    uint32_t outputBacklog;   // sonic output not yet read, likewise
+    uint32_t inputBacklogMax, outputBacklogMax;
+    uint64_t timing[ENGINE_TIMING_BUCKETS]; // blocks by time taken, see engine_timing_bucket_ns
+} EngineCallbackStats;
+void engine_callback_stats(Engine* e, EngineCallbackStats* out);
+// Longest time, in ns, counted in timing bucket i. Buckets are exact below
+// 16 ns and within 12.5% above.
+uint64_t engine_timing_bucket_ns(int i);
+// Time within which the share q (0 .. 1) of blocks completed, to a bucket.
+uint64_t engine_timing_percentile(const EngineCallbackStats* s, double q);
+
+// Decoded-PCM cache (see pcmcache.h) for files loaded whole, off until this
+// is called; the UI puts it in pcm_cache_default_dir. A NULL dir turns it
+// off; maxBytes 0 keeps the default cap. Call before the first load. Returns
+// 0 if `dir` is unusable, which also leaves the cache off.
+int engine_set_cache(Engine* e, const char* dir, uint64_t maxBytes);
+// Decodes `path` into the cache on the calling thread with the settings
+// above. 1 = stored, 0 = nothing to do (cached already, or a WAV that plays
+// in place), -1 = no cache or the file could not be decoded or stored.
+int engine_prewarm(Engine* e, const char* path);
+
+// UI thread.
+int engine_send(Engine* e, Cmd c);
+int engine_load(Engine* e, const char* path); // asynchronous, see loader_thread
+// Same for any voice. Voices playing the same file share its decoded PCM.
+int engine_load_voice(Engine* e, int voice, const char* path);
+void engine_collect(Engine* e);
+void engine_update_hints(Engine* e);
+
+// The deck's state.
+int engine_playing(Engine* e);
+int engine_reverse(Engine* e);
+int engine_loop(Engine* e);
+// Play position and length of the deck's track, in frames (0 without one).
+uint64_t engine_position(Engine* e);
+uint64_t engine_length(Engine* e);
+
+#endif // NOVA_ENGINE_H
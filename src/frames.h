@@ -0,0 +1,102 @@
+// src/frames.h
+//
+// Block copier behind read_from_buffer. Frames are interleaved s16 stereo, so
+// one frame is 4 bytes and reversing frames is reversing 32-bit lanes.
+// Header-only so the benchmarks can use the exact code the engine runs.
+
+#ifndef NOVA_FRAMES_H
+#define NOVA_FRAMES_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// out[0..n) = src[0..n)
+static inline void frames_copy_forward(int16_t* out, const int16_t* src, uint64_t n)
+{
+    memcpy(out, src, (size_t)n * 2 * sizeof(int16_t));
+}
+
+// out[0..n) = src[0], src[-1], ..., src[-(n-1)]  (src points at the first frame played)
+static inline void frames_copy_reverse(int16_t* out, const int16_t* src, uint64_t n)
+{
+    uint64_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i rev8 = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src - (i + 7) * 2));
+        _mm256_storeu_si256((__m256i*)(out + i * 2), _mm256_permutevar8x32_epi32(v, rev8));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src - (i + 3) * 2));
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t v = vld1q_u32((const uint32_t*)(src - (i + 3) * 2));
+        v = vrev64q_u32(v);
+        vst1q_u32((uint32_t*)(out + i * 2), vextq_u32(v, v, 2));
+    }
+#endif
+
+    for (; i < n; i++) {
+        memcpy(out + i * 2, src - i * 2, 2 * sizeof(int16_t));
+    }
+}
+
+// Copies up to outFrames frames starting at *cursor, moving forward or
+// backward and wrapping at the ends when loop is set. Works in contiguous runs
+// up to the next boundary. Like the per-frame loop it replaces, forward play
+// stops short of the last frame and reverse play short of frame 0.
+// Returns the number of frames written.
+static inline uint32_t frames_read(const int16_t* pcm, uint64_t frames, uint64_t* cursor,
+                                   int rev, int loop, int16_t* out, uint32_t outFrames)
+{
+    if (!pcm || frames == 0) return 0;
+
+    const uint64_t last = frames - 1;
+    uint64_t c = *cursor;
+    uint32_t done = 0;
+
+    while (done < outFrames) {
+        uint64_t run;
+        if (!rev) {
+            if (c >= last) {
+                if (!loop) break;
+                c = 0;
+            }
+            run = last - c;
+        } else {
+            if (c == 0) {
+                if (!loop) break;
+                c = last;
+            }
+            run = c;
+        }
+        if (run == 0) break; // single-frame buffer
+        if (run > outFrames - done) run = outFrames - done;
+
+        if (!rev) {
+            frames_copy_forward(out + (size_t)done * 2, pcm + c * 2, run);
+            c += run;
+        } else {
+            frames_copy_reverse(out + (size_t)done * 2, pcm + c * 2, run);
+            c -= run;
+        }
+        done += (uint32_t)run;
+    }
+
+    *cursor = c;
+    return done;
+}
+
+#endif // NOVA_FRAMES_H
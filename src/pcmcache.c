@@ -0,0 +1,427 @@
+// src/pcmcache.c
+//
+// See pcmcache.h. An entry is one file named after its key:
+//
+//   header     PcmCacheHeader, padded to PCM_CACHE_ALIGN
+//   pcm        frames * 2 s16, interleaved stereo
+//   peaks      peakCount * 4 s16
+//
+// Entries are written to a temporary name and renamed, so readers in other
+// processes see either nothing or a whole file, and unlinking an entry that
+// is mapped somewhere leaves that mapping valid. Recency is the entry's
+// mtime, bumped on every hit; eviction removes the oldest first.
+
+#include "pcmcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define PCM_CACHE_MAGIC    "NOVAPCM"
+#define PCM_CACHE_VERSION  1u
+#define PCM_CACHE_ALIGN    4096u // pcm starts on a page boundary
+#define PCM_CACHE_WINDOW   65536u // bytes hashed at the start, middle and end
+#define PCM_CACHE_SUFFIX   ".npcm"
+#define PCM_CACHE_STALE_S  86400  // temporaries older than this were abandoned
+
+#ifdef __APPLE__
+#define STAT_MTIME_NS(st) ((int64_t)(st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#else
+#define STAT_MTIME_NS(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+typedef struct {
+    char magic[8];        // PCM_CACHE_MAGIC
+    uint32_t version;     // PCM_CACHE_VERSION
+    uint32_t byteOrder;   // 0x01020304 as written
+    PcmCacheKey key;
+    uint32_t sampleRate;  // 48000
+    uint32_t channels;    // 2
+    uint32_t peakFrames;  // PCM_CACHE_PEAK_FRAMES
+    uint32_t reserved;
+    uint64_t frames;
+    uint64_t pcmOffset;
+    uint64_t peakOffset;
+    uint64_t peakCount;
+} PcmCacheHeader;
+
+struct PcmCache {
+    char dir[1024];
+    uint64_t maxBytes;
+};
+
+// 64-bit FNV-1a over 8-byte words with a final avalanche: several GB/s, and
+// only ever run over a few windows of each file.
+static uint64_t hash_bytes(uint64_t h, const uint8_t* p, size_t n)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; n; n--, p++) h = (h ^ *p) * prime;
+    return h;
+}
+
+static uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+const char* pcm_cache_dir(const PcmCache* c)
+{
+    return c->dir;
+}
+
+#ifndef _WIN32
+
+int pcm_cache_default_dir(char* out, size_t cap)
+{
+    const char* env = getenv("NOVA_CACHE_DIR");
+    int n;
+    if (env && env[0]) {
+        n = snprintf(out, cap, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && env[0]) {
+        n = snprintf(out, cap, "%s/novaaudio", env);
+    } else if ((env = getenv("HOME")) && env[0]) {
+        n = snprintf(out, cap, "%s/.cache/novaaudio", env);
+    } else {
+        return 0;
+    }
+    return n > 0 && (size_t)n < cap;
+}
+
+static int make_dirs(const char* dir)
+{
+    char path[1024];
+    size_t len = strlen(dir);
+    if (len == 0 || len >= sizeof(path)) return 0;
+    memcpy(path, dir, len + 1);
+    for (size_t i = 1; i <= len; i++) {
+        if (path[i] != '/' && path[i] != '\0') continue;
+        char keep = path[i];
+        path[i] = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return 0;
+        path[i] = keep;
+    }
+    struct stat st;
+    return stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+PcmCache* pcm_cache_open(const char* dir, uint64_t maxBytes)
+{
+    if (!dir || strlen(dir) >= sizeof(((PcmCache*)0)->dir) - 64) return NULL;
+    if (!make_dirs(dir)) {
+        fprintf(stderr, "PCM cache unavailable: %s\n", dir);
+        return NULL;
+    }
+    PcmCache* c = (PcmCache*)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+    c->maxBytes = maxBytes ? maxBytes : PCM_CACHE_DEFAULT_MAX_BYTES;
+    return c;
+}
+
+void pcm_cache_close(PcmCache* c)
+{
+    free(c);
+}
+
+int pcm_cache_key(FILE* f, uint32_t variant, PcmCacheKey* key)
+{
+    memset(key, 0, sizeof(*key));
+    int fd = fileno(f);
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    key->size = (uint64_t)st.st_size;
+    key->mtimeNs = STAT_MTIME_NS(st);
+    key->variant = variant;
+
+    // Start, middle and end: headers, a stretch of audio, trailing tags.
+    uint64_t at[3] = { 0, key->size / 2, key->size > PCM_CACHE_WINDOW ? key->size - PCM_CACHE_WINDOW : 0 };
+    uint8_t* buf = (uint8_t*)malloc(PCM_CACHE_WINDOW);
+    if (!buf) return 0;
+    uint64_t h = 0xcbf29ce484222325ull ^ key->size;
+    for (int i = 0; i < 3; i++) {
+        ssize_t n = pread(fd, buf, PCM_CACHE_WINDOW, (off_t)at[i]);
+        if (n < 0) {
+            free(buf);
+            return 0;
+        }
+        h = hash_bytes(h, buf, (size_t)n);
+    }
+    free(buf);
+    key->contentHash = hash_mix(h);
+    return 1;
+}
+
+static void entry_path(const PcmCache* c, const PcmCacheKey* key, char* out, size_t cap)
+{
+    uint64_t h = hash_bytes(0xcbf29ce484222325ull, (const uint8_t*)&key->size, sizeof(key->size));
+    h = hash_bytes(h, (const uint8_t*)&key->mtimeNs, sizeof(key->mtimeNs));
+    h = hash_bytes(h, (const uint8_t*)&key->contentHash, sizeof(key->contentHash));
+    h = hash_bytes(h, (const uint8_t*)&key->variant, sizeof(key->variant));
+    snprintf(out, cap, "%s/%016llx%s", c->dir, (unsigned long long)hash_mix(h), PCM_CACHE_SUFFIX);
+}
+
+static int key_equal(const PcmCacheKey* a, const PcmCacheKey* b)
+{
+    return a->size == b->size && a->mtimeNs == b->mtimeNs &&
+           a->contentHash == b->contentHash && a->variant == b->variant;
+}
+
+int pcm_cache_map(PcmCache* c, const PcmCacheKey* key, PcmCacheEntry* out)
+{
+    memset(out, 0, sizeof(*out));
+    char path[1200];
+    entry_path(c, key, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < PCM_CACHE_ALIGN) {
+        close(fd);
+        return 0;
+    }
+    size_t len = (size_t)st.st_size;
+    uint8_t* base = (uint8_t*)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    PcmCacheHeader h;
+    memcpy(&h, base, sizeof(h));
+    int ok = memcmp(h.magic, PCM_CACHE_MAGIC, sizeof(PCM_CACHE_MAGIC)) == 0 &&
+             h.version == PCM_CACHE_VERSION && h.byteOrder == 0x01020304u &&
+             key_equal(&h.key, key) &&
+             h.sampleRate == 48000 && h.channels == 2 && h.peakFrames == PCM_CACHE_PEAK_FRAMES &&
+             h.frames > 0 && h.pcmOffset == PCM_CACHE_ALIGN &&
+             h.frames <= (len - h.pcmOffset) / 4 &&
+             h.peakOffset == h.pcmOffset + h.frames * 4 &&
+             h.peakCount == (h.frames + PCM_CACHE_PEAK_FRAMES - 1) / PCM_CACHE_PEAK_FRAMES &&
+             h.peakCount <= (len - h.peakOffset) / 8;
+    if (!ok) {
+        munmap(base, len);
+        close(fd);
+        return 0;
+    }
+
+    futimens(fd, NULL); // most recently used; best effort on read-only media
+    close(fd);
+
+    out->map = base;
+    out->mapLen = len;
+    out->pcm = (const int16_t*)(base + h.pcmOffset);
+    out->frames = h.frames;
+    out->peaks = (const int16_t*)(base + h.peakOffset);
+    out->peakCount = h.peakCount;
+    return 1;
+}
+
+void pcm_cache_unmap(PcmCacheEntry* e)
+{
+    if (e->map) munmap(e->map, e->mapLen);
+    memset(e, 0, sizeof(*e));
+}
+
+static int write_all(int fd, const void* data, size_t n)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 1;
+}
+
+static void compute_peaks(const int16_t* pcm, uint64_t frames, int16_t* peaks)
+{
+    for (uint64_t b = 0; b * PCM_CACHE_PEAK_FRAMES < frames; b++) {
+        uint64_t from = b * PCM_CACHE_PEAK_FRAMES;
+        uint64_t to = from + PCM_CACHE_PEAK_FRAMES < frames ? from + PCM_CACHE_PEAK_FRAMES : frames;
+        int16_t lo0 = INT16_MAX, hi0 = INT16_MIN, lo1 = INT16_MAX, hi1 = INT16_MIN;
+        for (uint64_t i = from; i < to; i++) {
+            int16_t l = pcm[i * 2], r = pcm[i * 2 + 1];
+            lo0 = l < lo0 ? l : lo0;
+            hi0 = l > hi0 ? l : hi0;
+            lo1 = r < lo1 ? r : lo1;
+            hi1 = r > hi1 ? r : hi1;
+        }
+        peaks[b * 4 + 0] = lo0;
+        peaks[b * 4 + 1] = hi0;
+        peaks[b * 4 + 2] = lo1;
+        peaks[b * 4 + 3] = hi1;
+    }
+}
+
+int pcm_cache_store(PcmCache* c, const PcmCacheKey* key, const int16_t* pcm, uint64_t frames)
+{
+    if (frames == 0) return 0;
+    char path[1200], tmp[1300];
+    entry_path(c, key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    PcmCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PCM_CACHE_MAGIC, sizeof(PCM_CACHE_MAGIC));
+    h.version = PCM_CACHE_VERSION;
+    h.byteOrder = 0x01020304u;
+    h.key = *key;
+    h.sampleRate = 48000;
+    h.channels = 2;
+    h.peakFrames = PCM_CACHE_PEAK_FRAMES;
+    h.frames = frames;
+    h.pcmOffset = PCM_CACHE_ALIGN;
+    h.peakOffset = h.pcmOffset + frames * 4;
+    h.peakCount = (frames + PCM_CACHE_PEAK_FRAMES - 1) / PCM_CACHE_PEAK_FRAMES;
+
+    int16_t* peaks = (int16_t*)malloc((size_t)h.peakCount * 4 * sizeof(int16_t));
+    if (!peaks) return 0;
+    compute_peaks(pcm, frames, peaks);
+
+    uint8_t head[PCM_CACHE_ALIGN];
+    memset(head, 0, sizeof(head));
+    memcpy(head, &h, sizeof(h));
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0 &&
+             write_all(fd, head, sizeof(head)) &&
+             write_all(fd, pcm, (size_t)frames * 4) &&
+             write_all(fd, peaks, (size_t)h.peakCount * 8);
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    free(peaks);
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) {
+        unlink(tmp);
+        return 0;
+    }
+
+    pcm_cache_trim(c, 0, NULL);
+    return 1;
+}
+
+typedef struct {
+    char name[64];
+    uint64_t bytes;
+    int64_t mtimeNs;
+} CacheFile;
+
+static int cache_file_older(const void* a, const void* b)
+{
+    int64_t x = ((const CacheFile*)a)->mtimeNs, y = ((const CacheFile*)b)->mtimeNs;
+    return (x > y) - (x < y);
+}
+
+void pcm_cache_trim(PcmCache* c, uint64_t maxBytes, PcmCacheStats* left)
+{
+    if (left) memset(left, 0, sizeof(*left));
+    if (!maxBytes) maxBytes = c->maxBytes;
+
+    DIR* d = opendir(c->dir);
+    if (!d) return;
+    CacheFile* files = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        size_t n = strlen(de->d_name);
+        size_t sl = sizeof(PCM_CACHE_SUFFIX) - 1;
+        int temporary = n > 4 && strcmp(de->d_name + n - 4, ".tmp") == 0;
+        if (!temporary && (n <= sl || n >= sizeof(files->name) ||
+                           strcmp(de->d_name + n - sl, PCM_CACHE_SUFFIX) != 0)) {
+            continue; // not ours
+        }
+        char path[1200];
+        snprintf(path, sizeof(path), "%s/%s", c->dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (temporary) { // being written, unless its writer died long ago
+            if (now - st.st_mtime > PCM_CACHE_STALE_S) unlink(path);
+            continue;
+        }
+        if (count == cap) {
+            size_t newCap = cap ? cap * 2 : 64;
+            CacheFile* grown = (CacheFile*)realloc(files, newCap * sizeof(*files));
+            if (!grown) break;
+            files = grown;
+            cap = newCap;
+        }
+        memcpy(files[count].name, de->d_name, n + 1);
+        files[count].bytes = (uint64_t)st.st_size;
+        files[count].mtimeNs = STAT_MTIME_NS(st);
+        total += files[count].bytes;
+        count++;
+    }
+    closedir(d);
+
+    size_t kept = count;
+    if (total > maxBytes) {
+        qsort(files, count, sizeof(*files), cache_file_older);
+        for (size_t i = 0; i < count && total > maxBytes; i++) {
+            char path[1200];
+            snprintf(path, sizeof(path), "%s/%s", c->dir, files[i].name);
+            if (unlink(path) == 0) {
+                total -= files[i].bytes;
+                kept--;
+            }
+        }
+    }
+    free(files);
+    if (left) {
+        left->entries = kept;
+        left->bytes = total;
+    }
+}
+
+#else // _WIN32: no cache
+
+int pcm_cache_default_dir(char* out, size_t cap) { (void)out; (void)cap; return 0; }
+PcmCache* pcm_cache_open(const char* dir, uint64_t maxBytes) { (void)dir; (void)maxBytes; return NULL; }
+void pcm_cache_close(PcmCache* c) { (void)c; }
+int pcm_cache_key(FILE* f, uint32_t variant, PcmCacheKey* key)
+{
+    (void)f; (void)variant;
+    memset(key, 0, sizeof(*key));
+    return 0;
+}
+int pcm_cache_map(PcmCache* c, const PcmCacheKey* key, PcmCacheEntry* out)
+{
+    (void)c; (void)key;
+    memset(out, 0, sizeof(*out));
+    return 0;
+}
+void pcm_cache_unmap(PcmCacheEntry* e) { memset(e, 0, sizeof(*e)); }
+int pcm_cache_store(PcmCache* c, const PcmCacheKey* key, const int16_t* pcm, uint64_t frames)
+{
+    (void)c; (void)key; (void)pcm; (void)frames;
+    return 0;
+}
+void pcm_cache_trim(PcmCache* c, uint64_t maxBytes, PcmCacheStats* left)
+{
+    (void)c; (void)maxBytes;
+    if (left) memset(left, 0, sizeof(*left));
+}
+
+#endif
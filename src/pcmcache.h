@@ -0,0 +1,74 @@
+// src/pcmcache.h
+//
+// On-disk cache of decoded tracks: the engine's interleaved s16 stereo 48 kHz
+// PCM plus a min/max peak overview, one file per source in a flat directory.
+// Entries are laid out to be mmap'ed and played in place, so reopening a file
+// the engine has decoded before costs one open and one mmap. POSIX only; on
+// other platforms every call reports a miss and stores nothing.
+
+#ifndef NOVA_PCMCACHE_H
+#define NOVA_PCMCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PCM_CACHE_DEFAULT_MAX_BYTES (2ull << 30)
+#define PCM_CACHE_PEAK_FRAMES       1024u // frames summarized by one peak
+
+// Identifies the source and how it was decoded. Size and mtime catch edits;
+// the content hash covers a few windows of the file so copies of the same
+// bytes with a new mtime are told apart from files that merely look alike.
+typedef struct {
+    uint64_t size;
+    int64_t mtimeNs;
+    uint64_t contentHash;
+    uint32_t variant;     // decoder settings that change the PCM, caller-defined
+} PcmCacheKey;
+
+typedef struct {
+    void* map;            // pass to pcm_cache_unmap (or munmap map, mapLen)
+    size_t mapLen;
+    const int16_t* pcm;   // interleaved stereo, points into map
+    uint64_t frames;
+    const int16_t* peaks; // minL, maxL, minR, maxR per PCM_CACHE_PEAK_FRAMES
+    uint64_t peakCount;
+} PcmCacheEntry;
+
+typedef struct {
+    uint64_t entries;
+    uint64_t bytes;
+} PcmCacheStats;
+
+typedef struct PcmCache PcmCache;
+
+// $NOVA_CACHE_DIR, else $XDG_CACHE_HOME/novaaudio, else ~/.cache/novaaudio.
+// Returns 0 if none can be formed.
+int pcm_cache_default_dir(char* out, size_t cap);
+
+// Creates `dir` if needed. maxBytes 0 means PCM_CACHE_DEFAULT_MAX_BYTES. NULL
+// if the directory is unusable. A cache is immutable once open and may be
+// used from several threads and processes at once.
+PcmCache* pcm_cache_open(const char* dir, uint64_t maxBytes);
+void pcm_cache_close(PcmCache* c);
+const char* pcm_cache_dir(const PcmCache* c);
+
+// Builds the key of the open file `f`. Reads a few windows with pread; the
+// file position is left alone. Returns 0 on I/O errors.
+int pcm_cache_key(FILE* f, uint32_t variant, PcmCacheKey* key);
+
+// Maps the entry for `key` and marks it most recently used. Returns 0 on a
+// miss or a damaged entry.
+int pcm_cache_map(PcmCache* c, const PcmCacheKey* key, PcmCacheEntry* out);
+void pcm_cache_unmap(PcmCacheEntry* e);
+
+// Writes an entry (to a temporary file, renamed into place) and then evicts
+// least recently used entries until the cache fits its size cap again.
+// Returns 0 on failure, leaving no partial entry behind.
+int pcm_cache_store(PcmCache* c, const PcmCacheKey* key, const int16_t* pcm, uint64_t frames);
+
+// Evicts least recently used entries until the cache holds at most
+// `maxBytes` (its own cap when 0), and reports what is left.
+void pcm_cache_trim(PcmCache* c, uint64_t maxBytes, PcmCacheStats* left);
+
+#endif // NOVA_PCMCACHE_H
@@ -0,0 +1,499 @@
+// src/render.c
+//
+// novaaudio_render: offline, headless render through the same engine graph
+// the UI plays (read_from_buffer -> sonic), quantized to a 48 kHz s16 stereo
+// WAV as fast as the CPU allows. With --compare it checks the output against
+// a reference render, which makes it the golden-output harness for DSP work.
+
+#include "engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#define RENDER_DEFAULT_BLOCK 512 // a typical device period
+
+typedef struct {
+    const char* in;
+    const char* out;
+    const char* compare;
+    float tempo;
+    float volume;
+    int reverse;
+    int pitchFft;
+    int resampleLinear;
+    int loadThreads;
+    const char* cacheDir;
+    int noCache;
+    int voices;
+    int renderThreads;
+    int loops;
+    uint32_t block;
+    const char* statsJson;
+    double statsEvery;
+} RenderOptions;
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+        "usage: %s <input> <output.wav> [options]\n"
+        "  --tempo F        playback tempo, pitch preserved (default 1.0)\n"
+        "  --volume F       0 .. 1 (default 1.0)\n"
+        "  --reverse        play backwards from the last frame\n"
+        "  --loops N        play the file N times back to back (default 1)\n"
+        "  --voices N       mix N voices of the file, each starting 1/N further in,\n"
+        "                   at volume / N (default 1, at most %d)\n"
+        "  --pitch M        sonic pitch search, amdf or fft (default amdf)\n"
+        "  --block N        frames per engine block (default %d)\n"
+        "  --render-threads N threads rendering voices, 0 for one per CPU (default 0)\n"
+        "  --resample Q     non-48 kHz input conversion, sinc or linear (default sinc)\n"
+        "  --load-threads N threads decoding MP3 and converting, 0 for one per CPU (default 0)\n"
+        "  --cache DIR      read and fill a decoded-PCM cache in DIR (see novaaudio_cache);\n"
+        "                   off by default, so output never depends on cache state\n"
+        "  --no-cache       always decode, neither reading nor writing a cache (default)\n"
+        "  --stats-json F   append the engine's block timing and counters to F as one\n"
+        "                   JSON object per line, every --stats-every seconds and at the end\n"
+        "  --stats-every S  wall-clock seconds between those lines (default 1)\n"
+        "  --compare REF    fail unless the output matches REF sample for sample\n",
+        argv0, ENGINE_MAX_VOICES, RENDER_DEFAULT_BLOCK);
+}
+
+static int parse_args(int argc, char** argv, RenderOptions* o)
+{
+    memset(o, 0, sizeof(*o));
+    o->tempo = 1.0f;
+    o->volume = 1.0f;
+    o->loops = 1;
+    o->voices = 1;
+    o->block = RENDER_DEFAULT_BLOCK;
+    o->statsEvery = 1.0;
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        int hasValue = i + 1 < argc;
+
+        if (strcmp(a, "--reverse") == 0) {
+            o->reverse = 1;
+        } else if (strcmp(a, "--tempo") == 0 && hasValue) {
+            o->tempo = (float)atof(argv[++i]);
+        } else if (strcmp(a, "--volume") == 0 && hasValue) {
+            o->volume = (float)atof(argv[++i]);
+        } else if (strcmp(a, "--pitch") == 0 && hasValue) {
+            const char* m = argv[++i];
+            if (strcmp(m, "fft") == 0) o->pitchFft = 1;
+            else if (strcmp(m, "amdf") != 0) {
+                fprintf(stderr, "Unknown pitch search: %s\n", m);
+                return 0;
+            }
+        } else if (strcmp(a, "--resample") == 0 && hasValue) {
+            const char* q = argv[++i];
+            if (strcmp(q, "linear") == 0) o->resampleLinear = 1;
+            else if (strcmp(q, "sinc") != 0) {
+                fprintf(stderr, "Unknown resampler: %s\n", q);
+                return 0;
+            }
+        } else if (strcmp(a, "--load-threads") == 0 && hasValue) {
+            o->loadThreads = atoi(argv[++i]);
+        } else if (strcmp(a, "--cache") == 0 && hasValue) {
+            o->cacheDir = argv[++i];
+        } else if (strcmp(a, "--no-cache") == 0) {
+            o->noCache = 1;
+        } else if (strcmp(a, "--voices") == 0 && hasValue) {
+            o->voices = atoi(argv[++i]);
+        } else if (strcmp(a, "--render-threads") == 0 && hasValue) {
+            o->renderThreads = atoi(argv[++i]);
+        } else if (strcmp(a, "--loops") == 0 && hasValue) {
+            o->loops = atoi(argv[++i]);
+        } else if (strcmp(a, "--block") == 0 && hasValue) {
+            o->block = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(a, "--stats-json") == 0 && hasValue) {
+            o->statsJson = argv[++i];
+        } else if (strcmp(a, "--stats-every") == 0 && hasValue) {
+            o->statsEvery = atof(argv[++i]);
+        } else if (strcmp(a, "--compare") == 0 && hasValue) {
+            o->compare = argv[++i];
+        } else if (a[0] == '-' && a[1] == '-') {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", a);
+            return 0;
+        } else if (positional == 0) {
+            o->in = a;
+            positional++;
+        } else if (positional == 1) {
+            o->out = a;
+            positional++;
+        } else {
+            fprintf(stderr, "Unexpected argument: %s\n", a);
+            return 0;
+        }
+    }
+
+    if (!o->in || !o->out) return 0;
+    if (o->tempo < 0.1f || o->loops < 1 || o->block == 0 ||
+        o->voices < 1 || o->voices > ENGINE_MAX_VOICES || o->statsEvery <= 0.0) {
+        fprintf(stderr, "Invalid --tempo, --loops, --voices, --block or --stats-every\n");
+        return 0;
+    }
+    return 1;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// ---------------- WAV output ----------------
+
+static void put_le16(uint8_t* p, uint32_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put_le32(uint8_t* p, uint32_t v) { put_le16(p, v & 0xFFFF); put_le16(p + 2, v >> 16); }
+
+// RIFF sizes are 32-bit: past this the header can't describe the data.
+#define WAV_MAX_FRAMES ((UINT32_MAX - 36) / (ENGINE_CHANNELS * sizeof(int16_t)))
+
+// `frames` is at most WAV_MAX_FRAMES, see render.
+static void wav_header(uint8_t h[44], uint64_t frames)
+{
+    uint32_t dataBytes = (uint32_t)(frames * ENGINE_CHANNELS * sizeof(int16_t));
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, 36 + dataBytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, 1); // PCM
+    put_le16(h + 22, ENGINE_CHANNELS);
+    put_le32(h + 24, ENGINE_SAMPLE_RATE);
+    put_le32(h + 28, ENGINE_SAMPLE_RATE * ENGINE_CHANNELS * sizeof(int16_t));
+    put_le16(h + 32, ENGINE_CHANNELS * sizeof(int16_t));
+    put_le16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, dataBytes);
+}
+
+// Rounds the engine's f32 output to s16 the way a device would, clamping
+// anything the mix pushed past full scale.
+static void quantize_s16(int16_t* dst, const float* src, size_t n)
+{
+    // Branch-free so it vectorizes: round half away from zero, clamp as int.
+    for (size_t i = 0; i < n; i++) {
+        float v = src[i] * 32767.0f;
+        int32_t r = (int32_t)(v + copysignf(0.5f, v));
+        r = r > 32767 ? 32767 : r;
+        r = r < -32768 ? -32768 : r;
+        dst[i] = (int16_t)r;
+    }
+}
+
+// Written as host-order s16, which is little-endian everywhere we build.
+static int wav_write_frames(FILE* f, const int16_t* pcm, uint32_t frames)
+{
+    return fwrite(pcm, sizeof(int16_t) * ENGINE_CHANNELS, frames, f) == frames;
+}
+
+// ---------------- Reference comparison ----------------
+
+typedef struct {
+    FILE* f;
+    uint64_t frames;      // in the reference
+    uint64_t compared;
+    uint64_t firstDiff;   // UINT64_MAX while identical
+    int maxDiff;
+    int16_t* scratch;
+} Reference;
+
+static uint32_t rd_le16(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8); }
+static uint32_t rd_le32(const uint8_t* p) { return rd_le16(p) | (rd_le16(p + 2) << 16); }
+
+// Opens a WAV in the engine's format and leaves the file at its sample data.
+static int reference_open(Reference* r, const char* path, uint32_t block)
+{
+    memset(r, 0, sizeof(*r));
+    r->firstDiff = UINT64_MAX;
+
+    r->f = fopen(path, "rb");
+    if (!r->f) {
+        fprintf(stderr, "Cannot open reference: %s\n", path);
+        return 0;
+    }
+
+    uint8_t riff[12];
+    if (fread(riff, 1, 12, r->f) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+        fprintf(stderr, "Reference is not a WAV file: %s\n", path);
+        return 0;
+    }
+
+    int fmtOk = 0;
+    uint8_t ck[8];
+    while (fread(ck, 1, 8, r->f) == 8) {
+        uint32_t size = rd_le32(ck + 4);
+        if (memcmp(ck, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[16];
+            if (fread(fmt, 1, 16, r->f) != 16) break;
+            fmtOk = rd_le16(fmt + 2) == ENGINE_CHANNELS &&
+                    rd_le32(fmt + 4) == ENGINE_SAMPLE_RATE &&
+                    rd_le16(fmt + 14) == 16;
+            if (fseek(r->f, (long)(size - 16 + (size & 1)), SEEK_CUR) != 0) break;
+        } else if (memcmp(ck, "data", 4) == 0) {
+            if (!fmtOk) break;
+            r->frames = size / (ENGINE_CHANNELS * sizeof(int16_t));
+            r->scratch = (int16_t*)malloc((size_t)block * ENGINE_CHANNELS * sizeof(int16_t));
+            return r->scratch != NULL;
+        } else if (fseek(r->f, (long)(size + (size & 1)), SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    fprintf(stderr, "Reference must be 48 kHz s16 stereo PCM: %s\n", path);
+    return 0;
+}
+
+static void reference_check(Reference* r, const int16_t* pcm, uint32_t frames)
+{
+    uint64_t left = r->frames - r->compared;
+    uint32_t n = (left < frames) ? (uint32_t)left : frames;
+    if (n && fread(r->scratch, sizeof(int16_t) * ENGINE_CHANNELS, n, r->f) != n) n = 0;
+
+    for (uint32_t i = 0; i < n * ENGINE_CHANNELS; i++) {
+        int d = abs((int)pcm[i] - (int)r->scratch[i]);
+        if (d == 0) continue;
+        if (r->firstDiff == UINT64_MAX) r->firstDiff = r->compared + i / ENGINE_CHANNELS;
+        if (d > r->maxDiff) r->maxDiff = d;
+    }
+    r->compared += n;
+}
+
+static void reference_close(Reference* r)
+{
+    if (r->f) fclose(r->f);
+    free(r->scratch);
+}
+
+// ---------------- Stats ----------------
+
+typedef struct {
+    FILE* f;              // NULL without --stats-json
+    double start;
+    double every;
+    double next;
+} StatsDump;
+
+// One JSON object on one line: the callback stats with a few percentiles and
+// the non-empty timing buckets as [longest ns, blocks], then the render pool
+// and render-ahead counters. `t` is wall-clock seconds into the render.
+static void stats_write(StatsDump* d, Engine* e, double now, uint64_t frames)
+{
+    EngineCallbackStats cs;
+    EngineRenderStats rs;
+    engine_callback_stats(e, &cs);
+    engine_render_stats(e, &rs);
+
+    FILE* f = d->f;
+    fprintf(f, "{\"t\":%.3f,\"audio_s\":%.3f,\"blocks\":%llu,\"frames_requested\":%llu,"
+               "\"frames_rendered\":%llu,\"frames_starved\":%llu,\"underruns\":%llu,\"late_blocks\":%llu,",
+            now - d->start, (double)frames / ENGINE_SAMPLE_RATE, (unsigned long long)cs.blocks,
+            (unsigned long long)cs.framesRequested, (unsigned long long)cs.framesRendered,
+            (unsigned long long)cs.framesStarved, (unsigned long long)cs.underruns,
+            (unsigned long long)cs.lateBlocks);
+    fprintf(f, "\"block_ns\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},",
+            (unsigned long long)engine_timing_percentile(&cs, 0.5),
+            (unsigned long long)engine_timing_percentile(&cs, 0.9),
+            (unsigned long long)engine_timing_percentile(&cs, 0.99),
+            (unsigned long long)engine_timing_percentile(&cs, 0.999), (unsigned long long)cs.maxNs);
+    fprintf(f, "\"sonic_backlog\":{\"input\":%u,\"input_max\":%u,\"output\":%u,\"output_max\":%u},",
+            cs.inputBacklog, cs.inputBacklogMax, cs.outputBacklog, cs.outputBacklogMax);
+    fprintf(f, "\"render_pool\":{\"workers\":%d,\"blocks\":%llu,\"jobs\":%llu,\"steals\":%llu,"
+               "\"inline_jobs\":%llu,\"late_blocks\":%llu,\"join_wait_ns\":%llu,\"join_wait_max_ns\":%llu},",
+            rs.workers, (unsigned long long)rs.blocks, (unsigned long long)rs.jobs,
+            (unsigned long long)rs.steals, (unsigned long long)rs.inlineJobs,
+            (unsigned long long)rs.lateBlocks, (unsigned long long)rs.joinWaitNs,
+            (unsigned long long)rs.joinWaitMaxNs);
+    fprintf(f, "\"render_ahead\":{\"underruns\":%llu,\"invalidations\":%llu},\"timing\":[",
+            (unsigned long long)rs.aheadUnderruns, (unsigned long long)rs.aheadInvalidations);
+    const char* sep = "";
+    for (int i = 0; i < ENGINE_TIMING_BUCKETS; i++) {
+        if (!cs.timing[i]) continue;
+        fprintf(f, "%s[%llu,%llu]", sep, (unsigned long long)engine_timing_bucket_ns(i),
+                (unsigned long long)cs.timing[i]);
+        sep = ",";
+    }
+    fprintf(f, "]}\n");
+    fflush(f);
+    d->next = now + d->every;
+}
+
+// ---------------- Render ----------------
+
+static void send_all(Engine* e, int voices, Cmd c)
+{
+    for (c.voice = 0; c.voice < voices; c.voice++) engine_send(e, c);
+}
+
+// Renders until the last pass ends. Looping is left on in the engine until the
+// final pass has started, so pass boundaries sound exactly as in the UI. Pass
+// boundaries are counted on voice 0, which starts at the top of the file.
+static int render(Engine* e, const RenderOptions* o, FILE* out, Reference* ref, StatsDump* stats,
+                  uint64_t* framesOut, uint64_t* hashOut)
+{
+    float* mix = (float*)malloc((size_t)o->block * ENGINE_CHANNELS * sizeof(float));
+    int16_t* block = (int16_t*)malloc((size_t)o->block * ENGINE_CHANNELS * sizeof(int16_t));
+    if (!mix || !block) {
+        free(mix);
+        free(block);
+        return 0;
+    }
+
+    uint64_t len = engine_length(e);
+    send_all(e, o->voices, (Cmd){ .type = CMD_SET_TEMPO, .f = o->tempo });
+    send_all(e, o->voices, (Cmd){ .type = CMD_SET_VOLUME, .f = o->volume / (float)o->voices });
+    send_all(e, o->voices, (Cmd){ .type = CMD_SET_REVERSE, .i = o->reverse });
+    send_all(e, o->voices, (Cmd){ .type = CMD_SET_LOOP, .i = o->loops > 1 });
+    for (int v = 0; v < o->voices; v++) {
+        uint64_t offset = len / (uint64_t)o->voices * (uint64_t)v;
+        if (o->reverse) engine_send(e, (Cmd){ .type = CMD_SEEK, .voice = v, .frame = offset ? len - 1 - offset : UINT64_MAX });
+        else if (offset) engine_send(e, (Cmd){ .type = CMD_SEEK, .voice = v, .frame = offset });
+    }
+
+    uint64_t prev = o->reverse ? len : 0;
+    uint64_t frames = 0;
+    uint64_t hash = 1469598103934665603ull; // FNV-1a over the output samples
+    int pass = 1;
+    int ok = 1;
+
+    for (;;) {
+        uint32_t n = engine_render(e, mix, o->block);
+        quantize_s16(block, mix, (size_t)n * ENGINE_CHANNELS);
+
+        if (frames + n > WAV_MAX_FRAMES) {
+            fprintf(stderr, "Output passes the 4 GiB WAV limit at %.0f s; use fewer --loops or a faster --tempo\n",
+                    (double)frames / ENGINE_SAMPLE_RATE);
+            ok = 0;
+            break;
+        }
+        if (!wav_write_frames(out, block, n)) {
+            fprintf(stderr, "Write failed\n");
+            ok = 0;
+            break;
+        }
+        if (ref) reference_check(ref, block, n);
+        const uint8_t* b = (const uint8_t*)block;
+        for (size_t i = 0; i < (size_t)n * ENGINE_CHANNELS * sizeof(int16_t); i++) {
+            hash = (hash ^ b[i]) * 1099511628211ull;
+        }
+        frames += n;
+        if (stats->f) {
+            double now = now_sec();
+            if (now >= stats->next) stats_write(stats, e, now, frames);
+        }
+        if (n < o->block) break; // ended or stopped
+
+        uint64_t pos = engine_position(e);
+        int wrapped = o->reverse ? pos > prev : pos < prev;
+        prev = pos;
+        if (wrapped && ++pass == o->loops) {
+            send_all(e, o->voices, (Cmd){ .type = CMD_SET_LOOP, .i = 0 });
+        }
+    }
+
+    free(mix);
+    free(block);
+    *framesOut = frames;
+    *hashOut = hash;
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    RenderOptions o;
+    if (!parse_args(argc, argv, &o)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Engine* e = engine_create();
+    if (!e) return 2;
+    engine_set_pitch_method(e, o.pitchFft);
+    engine_set_resample(e, !o.resampleLinear, o.loadThreads);
+    engine_set_render_threads(e, o.renderThreads);
+    if (!o.noCache && o.cacheDir && !engine_set_cache(e, o.cacheDir, 0)) {
+        fprintf(stderr, "Cannot use cache directory, decoding uncached: %s\n", o.cacheDir);
+    }
+    int loaded = engine_open_offline(e, o.block);
+    for (int v = 0; loaded && v < o.voices; v++) loaded = engine_load_voice_now(e, v, o.in);
+    if (!loaded) {
+        engine_destroy(e);
+        return 2;
+    }
+
+    FILE* out = fopen(o.out, "wb");
+    if (!out) {
+        fprintf(stderr, "Cannot create: %s\n", o.out);
+        engine_destroy(e);
+        return 2;
+    }
+
+    Reference ref;
+    if (o.compare && !reference_open(&ref, o.compare, o.block)) {
+        reference_close(&ref);
+        fclose(out);
+        engine_destroy(e);
+        return 2;
+    }
+
+    uint8_t header[44];
+    wav_header(header, 0);
+    fwrite(header, 1, sizeof(header), out);
+
+    StatsDump stats = { .every = o.statsEvery };
+    if (o.statsJson && !(stats.f = fopen(o.statsJson, "a"))) {
+        fprintf(stderr, "Cannot open stats file, not writing stats: %s\n", o.statsJson);
+    }
+
+    uint64_t frames = 0, hash = 0;
+    double t0 = now_sec();
+    stats.start = t0;
+    stats.next = t0 + stats.every;
+    int ok = render(e, &o, out, o.compare ? &ref : NULL, &stats, &frames, &hash);
+    double dt = now_sec() - t0;
+    if (stats.f) {
+        stats_write(&stats, e, now_sec(), frames);
+        fclose(stats.f);
+    }
+
+    EngineRenderStats rs;
+    engine_render_stats(e, &rs);
+    wav_header(header, frames); // even after a failure, so what was written stays readable
+    ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(header, 1, sizeof(header), out) == sizeof(header) && ok;
+    ok = (fclose(out) == 0) && ok;
+    engine_destroy(e);
+    if (!ok) {
+        if (o.compare) reference_close(&ref);
+        return 2;
+    }
+
+    double seconds = (double)frames / ENGINE_SAMPLE_RATE;
+    printf("%s: %.3f s of audio in %.3f s (%.1fx realtime), fnv1a %016llx\n",
+           o.out, seconds, dt, dt > 0.0 ? seconds / dt : 0.0, (unsigned long long)hash);
+    if (rs.blocks) {
+        printf("render pool: %d workers, %llu blocks, %.1f%% of %llu jobs stolen, %llu inline past the deadline, "
+               "%llu late blocks, join wait %.1f us avg / %.1f us max\n",
+               rs.workers, (unsigned long long)rs.blocks, 100.0 * (double)rs.steals / (double)rs.jobs,
+               (unsigned long long)rs.jobs, (unsigned long long)rs.inlineJobs, (unsigned long long)rs.lateBlocks,
+               (double)rs.joinWaitNs / 1e3 / (double)rs.blocks, (double)rs.joinWaitMaxNs / 1e3);
+    }
+
+    if (o.compare) {
+        int match = ref.frames == frames && ref.firstDiff == UINT64_MAX;
+        if (match) {
+            printf("matches %s\n", o.compare);
+        } else {
+            printf("DIFFERS from %s: %llu vs %llu frames, first difference at frame %lld, max |diff| %d\n",
+                   o.compare, (unsigned long long)frames, (unsigned long long)ref.frames,
+                   ref.firstDiff == UINT64_MAX ? -1ll : (long long)ref.firstDiff, ref.maxDiff);
+        }
+        reference_close(&ref);
+        return match ? 0 : 3;
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// tests/render_ahead.c
+//
+// Checks what render-ahead plays around an invalidation. Runs the producer
+// with a full lead against a test-side consumer and compares against a run
+// without commands: controls sent again at their current value must leave
+// the output bit-identical, and real changes must not click where the
+// re-rendered audio replaces what was rendered early. Built like the stress
+// test, see CMakeLists.txt. Includes engine.c to drive the ring directly.
+//
+//   novaaudio_test_render_ahead <file.wav>
+
+#include "engine.c"
+
+#define AHEAD_BLOCK      480   // frames per slot and per read, 10 ms
+#define AHEAD_MS         150
+#define AHEAD_BLOCKS     600   // 6 s, the test file loops
+#define AHEAD_EVERY      10    // blocks between commands
+#define AHEAD_TEMPO      0.8f
+#define AHEAD_MAX_STEP   3.0f  // allowed sample step, relative to the run without commands
+#define AHEAD_TIMEOUT_MS 20000
+
+typedef enum { SEND_NOTHING, SEND_NO_OPS, SEND_CHANGES } Sends;
+
+// Commands sent before block `b`.
+static void ahead_send(Engine* e, Sends sends, int b)
+{
+    if (sends == SEND_NOTHING || b == 0 || b % AHEAD_EVERY) return;
+    if (sends == SEND_NO_OPS) {
+        int n = b / AHEAD_EVERY % 4;
+        if (n == 0) engine_send(e, (Cmd){ .type = CMD_SET_LOOP, .i = 1 });
+        if (n == 1) engine_send(e, (Cmd){ .type = CMD_SET_TEMPO, .f = AHEAD_TEMPO });
+        if (n == 2) engine_send(e, (Cmd){ .type = CMD_SET_PLAYING, .i = 1 });
+        if (n == 3) engine_send(e, (Cmd){ .type = CMD_SET_CROSSFADE, .i = 4800 });
+    } else {
+        int up = b / AHEAD_EVERY % 2;
+        engine_send(e, (Cmd){ .type = CMD_SET_VOLUME, .f = up ? 1.0f : 0.6f });
+        engine_send(e, (Cmd){ .type = CMD_SET_TEMPO, .f = up ? AHEAD_TEMPO : 1.1f });
+    }
+}
+
+// Plays AHEAD_BLOCKS blocks of `path` at AHEAD_TEMPO into `out`, waiting for
+// a full ring before each read. Returns the invalidations, or -1 on failure.
+static int ahead_run(const char* path, Sends sends, float* out)
+{
+    Engine* e = engine_create();
+    if (!e) return -1;
+    engine_set_render_ahead(e, AHEAD_MS);
+    int ok = engine_open_offline(e, AHEAD_BLOCK) && engine_load_now(e, path);
+    if (ok) {
+        engine_send(e, (Cmd){ .type = CMD_SET_LOOP, .i = 1 });
+        engine_send(e, (Cmd){ .type = CMD_SET_TEMPO, .f = AHEAD_TEMPO });
+        render_ahead_start(e, AHEAD_BLOCK);
+        ok = e->ahead.running;
+    }
+
+    RenderAhead* a = &e->ahead;
+    for (int b = 0; ok && b < AHEAD_BLOCKS; b++) {
+        ahead_send(e, sends, b);
+        for (int waited = 0;; waited++) {
+            uint32_t tail = atomic_load(&a->tail), head = atomic_load(&a->head);
+            // Invalidations back to back can leave the ring full of skipped slots.
+            int full = render_ahead_ready(a, tail, head) >= a->target || head - tail == a->slots;
+            if (full && atomic_load(&e->cmds.tail) == atomic_load(&e->cmds.head)) break;
+            if (waited == AHEAD_TIMEOUT_MS) {
+                fprintf(stderr, "render_ahead: the producer never filled the lead\n");
+                ok = 0;
+                break;
+            }
+            ma_sleep(1);
+        }
+        ok = ok && render_ahead_read(a, out + (size_t)b * AHEAD_BLOCK * 2, AHEAD_BLOCK) == AHEAD_BLOCK;
+    }
+    render_ahead_stop(e);
+    int invalidations = (int)atomic_load(&a->invalidations);
+    engine_destroy(e);
+    return ok ? invalidations : -1;
+}
+
+static float max_step(const float* x, size_t frames)
+{
+    float m = 0.0f;
+    for (size_t i = 2; i < frames * 2; i++) {
+        float d = fabsf(x[i] - x[i - 2]);
+        m = d > m ? d : m;
+    }
+    return m;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.wav>\n", argv[0]);
+        return 2;
+    }
+    size_t samples = (size_t)AHEAD_BLOCKS * AHEAD_BLOCK * 2;
+    float* ref = (float*)malloc(samples * sizeof(float));
+    float* out = (float*)malloc(samples * sizeof(float));
+    if (!ref || !out) return 1;
+
+    int ok = ahead_run(argv[1], SEND_NOTHING, ref) >= 0;
+    float natural = max_step(ref, samples / 2);
+
+    int inv = ok ? ahead_run(argv[1], SEND_NO_OPS, out) : -1;
+    size_t diff = 0;
+    for (size_t i = 0; inv >= 0 && i < samples; i++) diff += memcmp(&ref[i], &out[i], sizeof(float)) != 0;
+    int pass = inv >= 0 && diff == 0;
+    printf("render_ahead: no-op commands, %d invalidations, %zu samples differ%s\n", inv, diff,
+           pass ? "" : "  FAILED");
+    ok = ok && pass;
+
+    inv = ok ? ahead_run(argv[1], SEND_CHANGES, out) : -1;
+    float step = inv >= 0 ? max_step(out, samples / 2) : 0.0f;
+    pass = inv > 0 && step <= natural * AHEAD_MAX_STEP;
+    printf("render_ahead: changes, %d invalidations, max step %.4f (%.4f without)%s\n", inv, step, natural,
+           pass ? "" : "  FAILED");
+    ok = ok && pass;
+
+    free(ref);
+    free(out);
+    return ok ? 0 : 1;
+}
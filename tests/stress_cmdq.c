@@ -0,0 +1,316 @@
+// tests/stress_cmdq.c
+//
+// Stress test for the UI -> audio command queue. Opens the engine on
+// miniaudio's null backend, floods engine_send from a UI thread with random
+// per-voice commands while tracks load and get collected, then checks that
+// the audio side drained every command that was accepted and that each voice
+// ends in the state its last commands asked for. Built with ThreadSanitizer,
+// see CMakeLists.txt, and with the engine's debug checks on, so a non-finite
+// sample anywhere in the mix aborts the run. Includes engine.c to look at the
+// queue and the voices.
+//
+//   novaaudio_stress_cmdq <file.wav> [--render-ahead MS] [--seed N]
+
+#include "engine.c"
+
+#define STRESS_LOADED_VOICES 8      // voices that get a track, the rest stay empty
+#define STRESS_FLOOD_CMDS    20000  // random commands while tracks load
+#define STRESS_FINAL_CMDS    8000   // random commands after every load landed
+#define STRESS_TIMEOUT_MS    20000
+
+// Last value the UI sent for each per-voice setting.
+typedef struct {
+    int playing, reverse, loop;
+    float tempo, volume;
+} Expect;
+
+typedef struct {
+    Engine* e;
+    const char* path;
+    uint64_t rng;
+    Expect expect[ENGINE_MAX_VOICES];
+    uint64_t pushed;   // commands engine_send accepted
+    uint64_t full;     // engine_send calls that found the queue full
+    uint64_t retried;  // commands that needed at least one retry
+    uint64_t invalid;  // commands sent to a voice outside the mixer
+    uint64_t loads;
+    int ok;
+} Stress;
+
+static uint32_t rng_next(Stress* s)
+{
+    // xorshift64*, fixed seed so a failing run can be replayed.
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return (uint32_t)((s->rng * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static float rng_unit(Stress* s)
+{
+    return (float)(rng_next(s) >> 8) / (float)(1u << 24);
+}
+
+// UI thread: hands `c` to the audio side, retrying while the queue is full,
+// and remembers what a valid command sets.
+static void stress_send(Stress* s, Cmd c)
+{
+    int tries = 0;
+    while (!engine_send(s->e, c)) {
+        s->full++;
+        if (tries++ == 0) s->retried++;
+        ma_sleep(1);
+    }
+    s->pushed++;
+
+    if (c.voice < 0 || c.voice >= ENGINE_MAX_VOICES) {
+        s->invalid++;
+        return;
+    }
+    Expect* x = &s->expect[c.voice];
+    switch (c.type) {
+    case CMD_SET_PLAYING: x->playing = c.i; break;
+    case CMD_SET_REVERSE: x->reverse = c.i; break;
+    case CMD_SET_LOOP:    x->loop = c.i;    break;
+    case CMD_SET_TEMPO:   x->tempo = c.f;   break;
+    case CMD_SET_VOLUME:  x->volume = c.f < 0.0f ? 0.0f : c.f > 1.0f ? 1.0f : c.f; break;
+    default: break;
+    }
+}
+
+static Cmd stress_cmd(Stress* s, CmdType type, int voice)
+{
+    Cmd c = { .type = type, .voice = voice };
+    switch (type) {
+    case CMD_SEEK:
+        c.frame = rng_next(s) % 16 == 0 ? UINT64_MAX : rng_next(s) % 96000;
+        break;
+    case CMD_FLUSH: break;
+    case CMD_SET_CROSSFADE: c.i = (int)(rng_next(s) % 3) * 6000; break;
+    case CMD_SET_PLAYING:
+    case CMD_SET_REVERSE:
+    case CMD_SET_LOOP:      c.i = (int)(rng_next(s) & 1); break;
+    case CMD_SET_TEMPO:     c.f = 0.5f + 1.5f * rng_unit(s); break;
+    case CMD_SET_VOLUME:    c.f = -0.25f + 1.5f * rng_unit(s); break; // clamped by the engine
+    }
+    return c;
+}
+
+static Cmd stress_random(Stress* s)
+{
+    int voice;
+    uint32_t r = rng_next(s) % 100;
+    if (r < 2) voice = r ? -1 : ENGINE_MAX_VOICES;
+    else if (r < 70) voice = (int)(rng_next(s) % STRESS_LOADED_VOICES);
+    else voice = (int)(rng_next(s) % ENGINE_MAX_VOICES);
+    return stress_cmd(s, (CmdType)(rng_next(s) % (CMD_SET_VOLUME + 1)), voice);
+}
+
+// UI thread: no load waiting, being built, or published but not yet adopted.
+static int stress_loader_idle(Engine* e)
+{
+    Loader* l = &e->loader;
+    ma_mutex_lock(&l->lock);
+    int idle = !l->busy;
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) idle = idle && !l->hasRequest[i];
+    ma_mutex_unlock(&l->lock);
+
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        if (atomic_load(&e->voices[i].next)) idle = 0;
+    }
+    return idle;
+}
+
+static ma_thread_result MA_THREADCALL stress_ui_thread(void* arg)
+{
+    Stress* s = (Stress*)arg;
+    Engine* e = s->e;
+
+    // Tracks come and go under the flood; adopting one starts its voice.
+    for (int n = 0; n < STRESS_FLOOD_CMDS; n++) {
+        if (n % 400 == 0) {
+            int voice = (int)(rng_next(s) % STRESS_LOADED_VOICES);
+            if (voice == 0) engine_load(e, s->path);
+            else engine_load_voice(e, voice, s->path);
+            s->loads++;
+        }
+        if (n % 100 == 0) {
+            engine_collect(e);
+            engine_update_hints(e);
+        }
+        stress_send(s, stress_random(s));
+    }
+
+    // Every voice must have a track before the final state means anything.
+    for (int i = 0; i < STRESS_LOADED_VOICES; i++) engine_load_voice(e, i, s->path);
+    s->loads += STRESS_LOADED_VOICES;
+    int waited = 0;
+    while (!stress_loader_idle(e)) {
+        engine_collect(e);
+        if (waited++ == STRESS_TIMEOUT_MS) {
+            fprintf(stderr, "stress: loader never went idle\n");
+            s->ok = 0;
+            return (ma_thread_result)0;
+        }
+        ma_sleep(1);
+    }
+
+    // One command of every setting for every voice, shuffled into more noise.
+    Cmd settings[ENGINE_MAX_VOICES * 5];
+    int count = 0;
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        for (CmdType type = CMD_SET_PLAYING; type <= CMD_SET_VOLUME; type++) {
+            settings[count++] = stress_cmd(s, type, i);
+        }
+    }
+    for (int i = count - 1; i > 0; i--) {
+        int j = (int)(rng_next(s) % (uint32_t)(i + 1));
+        Cmd t = settings[i];
+        settings[i] = settings[j];
+        settings[j] = t;
+    }
+    int next = 0;
+    for (int n = 0; n < STRESS_FINAL_CMDS || next < count; n++) {
+        if (next < count && rng_next(s) % (STRESS_FINAL_CMDS / count + 1) == 0) stress_send(s, settings[next++]);
+        else if (n < STRESS_FINAL_CMDS) stress_send(s, stress_random(s));
+        if (n % 100 == 0) engine_collect(e);
+    }
+
+    // Wait for audio_cb (or the render-ahead producer) to drain the queue.
+    waited = 0;
+    while (atomic_load(&e->cmds.tail) != atomic_load(&e->cmds.head)) {
+        if (waited++ == STRESS_TIMEOUT_MS) {
+            fprintf(stderr, "stress: command queue never drained\n");
+            s->ok = 0;
+            break;
+        }
+        ma_sleep(1);
+    }
+    return (ma_thread_result)0;
+}
+
+// After the device is closed: every accepted command was popped, and the
+// voices hold what was sent last.
+static int stress_check(Stress* s)
+{
+    Engine* e = s->e;
+    int ok = s->ok;
+    uint32_t head = atomic_load(&e->cmds.head), tail = atomic_load(&e->cmds.tail);
+    if (head != (uint32_t)s->pushed || tail != head) {
+        fprintf(stderr, "stress: %llu commands accepted, queue head %u tail %u\n",
+                (unsigned long long)s->pushed, head, tail);
+        ok = 0;
+    }
+
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        Voice* v = &e->voices[i];
+        const Expect* x = &s->expect[i];
+        int playing = atomic_load(&v->playing);
+        // A voice that doesn't loop stops by itself at the end of its track.
+        int ended = !playing && x->playing && !x->loop && v->track;
+        if ((playing != x->playing && !ended) || atomic_load(&v->reverse) != x->reverse ||
+            atomic_load(&v->loop) != x->loop || v->tempo.target != x->tempo ||
+            v->volume.target != x->volume) {
+            fprintf(stderr,
+                    "stress: voice %d has playing %d reverse %d loop %d tempo %g volume %g, "
+                    "last sent %d %d %d %g %g\n",
+                    i, playing, atomic_load(&v->reverse), atomic_load(&v->loop), v->tempo.target,
+                    v->volume.target, x->playing, x->reverse, x->loop, x->tempo, x->volume);
+            ok = 0;
+        }
+        if (i < STRESS_LOADED_VOICES && !v->track) {
+            fprintf(stderr, "stress: voice %d has no track\n", i);
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+// Offline: turning the crossfade off while one runs must not touch the fade
+// in progress, whose gain divides by its length.
+static int stress_crossfade_cut(const char* path)
+{
+    enum { BLOCK = 1024 };
+    static float out[BLOCK * 2];
+    Engine* e = engine_create();
+    if (!e) return 0;
+    engine_set_cache(e, NULL, 0);
+    int ok = engine_open_offline(e, BLOCK) && engine_load_now(e, path);
+    for (int b = 0; ok && b < 40; b++) {
+        if (b == 20) ok = engine_load_now(e, path);
+        if (b == 24) engine_send(e, (Cmd){ .type = CMD_SET_CROSSFADE, .i = 0 });
+        if (b == 28) engine_send(e, (Cmd){ .type = CMD_SET_CROSSFADE, .i = 12000 });
+        if (b == 30) ok = ok && engine_load_now(e, path);
+        if (b == 32) engine_send(e, (Cmd){ .type = CMD_SET_CROSSFADE, .i = 600 });
+        engine_render(e, out, BLOCK);
+        for (int i = 0; ok && i < BLOCK * 2; i++) {
+            if (!isfinite(out[i])) {
+                fprintf(stderr, "stress: block %d frame %d is not finite after a crossfade change\n", b, i / 2);
+                ok = 0;
+            }
+        }
+    }
+    engine_destroy(e);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.wav> [--render-ahead MS] [--seed N]\n", argv[0]);
+        return 2;
+    }
+    uint32_t aheadMs = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--render-ahead") == 0) aheadMs = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0) seed = strtoull(argv[i + 1], NULL, 0);
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (!stress_crossfade_cut(argv[1])) {
+        printf("stress_cmdq: crossfade change during a fade: FAILED\n");
+        return 1;
+    }
+
+    Engine* e = engine_create();
+    if (!e) return 1;
+    engine_set_cache(e, NULL, 0);
+    engine_set_render_threads(e, 3);
+    engine_set_render_ahead(e, aheadMs);
+    if (!engine_open_device(e)) {
+        fprintf(stderr, "stress: cannot open the null device\n");
+        engine_destroy(e);
+        return 1;
+    }
+
+    Stress s = { .e = e, .path = argv[1], .rng = seed ? seed : 1, .ok = 1 };
+    for (int i = 0; i < ENGINE_MAX_VOICES; i++) {
+        s.expect[i] = (Expect){ .playing = atomic_load(&e->voices[i].playing),
+                                .reverse = atomic_load(&e->voices[i].reverse),
+                                .loop = atomic_load(&e->voices[i].loop),
+                                .tempo = e->voices[i].tempo.target,
+                                .volume = e->voices[i].volume.target };
+    }
+
+    ma_thread ui;
+    if (ma_thread_create(&ui, ma_thread_priority_normal, 0, stress_ui_thread, &s, NULL) != MA_SUCCESS) {
+        engine_close_device(e);
+        engine_destroy(e);
+        return 1;
+    }
+    ma_thread_wait(&ui);
+    engine_close_device(e);
+
+    int ok = stress_check(&s);
+    printf("stress_cmdq: render-ahead %u ms, %llu commands (%llu to invalid voices), %llu full, "
+           "%llu retried, %llu loads: %s\n",
+           aheadMs, (unsigned long long)s.pushed, (unsigned long long)s.invalid,
+           (unsigned long long)s.full, (unsigned long long)s.retried, (unsigned long long)s.loads,
+           ok ? "ok" : "FAILED");
+    engine_destroy(e);
+    return ok ? 0 : 1;
+}
@@ -13,6 +13,25 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* SIMD for the AMDF pitch search and overlap-add.  SSE2 is baseline on x86-64
+   and NEON on AArch64; AVX2 is compiled in with a target attribute and picked
+   at run time, so the library still runs on CPUs without it. */
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SONIC_SIMD_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define SONIC_SIMD_AVX2 1
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SONIC_SIMD_NEON 1
+#endif
+
 /*
     The following code was used to generate the following sinc lookup table.
 
@@ -181,14 +200,58 @@ static void sonicFree(void* p) { memoryBufferPos = 0; }
 
 #endif
 
+/* Levels in the pitch search's decimation pyramid. */
+#define SONIC_PYRAMID_LEVELS 3
+
+/* Overlap-add gain tables cached per stream.  Consecutive pitch periods are
+   usually within a few samples of each other, so a handful of lengths covers
+   steady voicing. */
+#define SONIC_RAMP_SLOTS 4
+
+/* Phases in the rate change's polyphase filter bank.  Ratios needing more
+   blend the two nearest of SINC_LOBE_POINTS + 1 rows instead. */
+#define SONIC_RATE_MAX_PHASES 512
+
+/* Sinc table points per filter tap. */
+#define SINC_LOBE_POINTS ((SINC_TABLE_SIZE - 1) / SINC_FILTER_POINTS)
+#if SINC_LOBE_POINTS * SINC_FILTER_POINTS != SINC_TABLE_SIZE - 1 || \
+    SINC_LOBE_POINTS + 1 > SONIC_RATE_MAX_PHASES
+#error "The blended rate bank needs whole lobes that fit the bank."
+#endif
+
 struct sonicStreamStruct {
 #ifdef SONIC_SPECTROGRAM
   sonicSpectrogram spectrogram;
 #endif /* SONIC_SPECTROGRAM */
+  /* The input, output and pitch buffers slide over their allocations:
+     inputBuffer is the first live frame inside inputBase, and removing
+     samples advances it rather than moving the rest down.  See
+     reserveFrames.  Output and pitch samples are floats on the short scale,
+     so overlap-add, rate changes and volume keep their fractions and never
+     clip; reading shorts rounds and clamps. */
   short* inputBuffer;
-  short* outputBuffer;
-  short* pitchBuffer;
-  short* downSampleBuffer;
+  float* outputBuffer;
+  float* pitchBuffer;
+  short* inputBase;
+  float* outputBase;
+  float* pitchBase;
+  /* Decimation pyramid for the pitch search, kept in step with the input
+     buffer as samples arrive and leave, so each search reads decimated data
+     instead of re-averaging maxRequired samples.  Level 0 is the channel
+     average at the full rate (unused for mono, where the input buffer serves).
+     Levels 1 and 2 average pyramidSkip[k] frames of every channel, in groups
+     aligned to the stream rather than to each search: group 0 starts
+     pyramidPhase[k] frames before the input buffer, and the group still
+     filling is held in pyramidSum[k] and pyramidFill[k].  Levels slide over
+     pyramidBase[k] like the sample buffers. */
+  short* pyramid[SONIC_PYRAMID_LEVELS];
+  short* pyramidBase[SONIC_PYRAMID_LEVELS];
+  int pyramidSize[SONIC_PYRAMID_LEVELS];
+  int pyramidCount[SONIC_PYRAMID_LEVELS];
+  int pyramidSkip[SONIC_PYRAMID_LEVELS];
+  int pyramidPhase[SONIC_PYRAMID_LEVELS];
+  long pyramidSum[SONIC_PYRAMID_LEVELS];
+  int pyramidFill[SONIC_PYRAMID_LEVELS];
   void* userData;
   float speed;
   float volume;
@@ -232,8 +295,101 @@ struct sonicStreamStruct {
   int sampleRate;
   int prevPeriod;
   int prevMinDiff;
+  /* SONIC_PITCH_FFT state, allocated only while that method is selected.
+     fftSize is a power of two, at least 2 * maxPeriod. */
+  int pitchMethod;
+  int fftSize;
+  int* fftBitReverse;
+  double* fftCos;  /* Twiddles per stage: half h uses entries h - 1 .. 2h - 2 */
+  double* fftSin;
+  double* fftReal;
+  double* fftImag;
+  long long* fftEnergy;  /* Prefix sums of squared samples, maxRequired + 1 */
+  /* Overlap-add gains for the current curve: slot i holds rampDown then rampUp
+     for an overlap of rampLength[i] frames, each up to maxPeriod floats.  A
+     length of 0 marks an empty slot, and rampNext is the one to replace. */
+  int overlapCurve;
+  float* rampTables;
+  int rampLength[SONIC_RAMP_SLOTS];
+  int rampNext;
+  /* Polyphase filter bank for adjustRate, up to SONIC_RATE_MAX_PHASES rows
+     of SINC_FILTER_POINTS taps, built for the rates in rateKeyNew and
+     rateKeyOld.  adjustRate steps through them reduced by their gcd,
+     rateGrid, to rateNewRate : rateOldRate; rateNewRate is 0 until the first
+     rate change.  If ratePhaseScale is 0 the bank holds one row per phase,
+     otherwise rows to blend between, see selectRateBank. */
+  float* rateBank;
+  int rateKeyNew;
+  int rateKeyOld;
+  int rateNewRate;
+  int rateOldRate;
+  int rateGrid;
+  float ratePhaseScale;
+  /* Streams from sonicCreateStreamRT live at the start of an arena that also
+     holds their buffers, sized for the worst case so they never grow.
+     rtMaxBlock is 0 for other streams.  realtime is set once creation is
+     done; after that, every request for memory goes to the allocation hook. */
+  unsigned char* arena;
+  long arenaSize;
+  long arenaStart;
+  long arenaUsed;
+  int rtMaxBlock;
+  float rtMinSpeed;
+  float rtMaxSpeed;
+  int realtime;
 };
 
+/* Arena carvings are aligned for SIMD loads of the buffers. */
+#define SONIC_ARENA_ALIGN 16
+
+static sonicAllocationHook allocationHook = NULL;
+
+/* Set the hook that real-time streams report allocations to. */
+void sonicSetAllocationHook(sonicAllocationHook hook) {
+  allocationHook = hook;
+}
+
+/* Round len up to the arena alignment. */
+static long arenaAlign(long len) {
+  return (len + SONIC_ARENA_ALIGN - 1) & ~(long)(SONIC_ARENA_ALIGN - 1);
+}
+
+/* Report a request for memory by a real-time stream after its creation. */
+static void reportAllocation(sonicStream stream, long bytes) {
+  if (stream->realtime && allocationHook != NULL) {
+    allocationHook(stream, bytes);
+  }
+}
+
+/* Allocate zeroed memory for one of the stream's buffers: from its arena if
+   it has one with room left, else from the heap. */
+static void* streamCalloc(sonicStream stream, int num, int size) {
+  long len = (long)num * size;
+  unsigned char* p;
+
+  reportAllocation(stream, len);
+  if (stream->arena != NULL &&
+      stream->arenaUsed + arenaAlign(len) <= stream->arenaSize) {
+    p = stream->arena + stream->arenaUsed;
+    stream->arenaUsed += arenaAlign(len);
+    memset(p, 0, len);
+    return p;
+  }
+  return sonicCalloc(num, size);
+}
+
+/* Free memory from streamCalloc.  Arena memory is only reclaimed all at once,
+   when freeStreamBuffers resets the arena. */
+static void streamFree(sonicStream stream, void* p) {
+  unsigned char* c = (unsigned char*)p;
+
+  if (stream->arena != NULL && c >= stream->arena &&
+      c < stream->arena + stream->arenaSize) {
+    return;
+  }
+  sonicFree(p);
+}
+
 /* Attach user data to the stream. */
 void sonicSetUserData(sonicStream stream, void* userData) {
   stream->userData = userData;
@@ -258,29 +414,35 @@ sonicSpectrogram sonicGetSpectrogram(sonicStream stream) {
 
 #endif
 
-/* Scale the samples by the factor. */
-static void scaleSamples(short* samples, int numSamples, float volume) {
-  /* This is 24-bit integer and 8-bit fraction fixed-point representation. */
-  int fixedPointVolume = volume * 256.0f;
-  int value;
-
-  while (numSamples--) {
-    value = (*samples * fixedPointVolume) >> 8;
-    if (value > 32767) {
-      value = 32767;
-    } else if (value < -32767) {
-      value = -32767;
-    }
-    *samples++ = value;
+/* Scale the samples by the factor.  Written so compilers vectorize it. */
+static void scaleSamples(float* samples, int numSamples, float volume) {
+  int i;
+
+  for (i = 0; i < numSamples; i++) {
+    samples[i] *= volume;
   }
 }
 
+/* Round an output sample to a short, clamping it to the short range.  There
+   are no float branches, so loops calling this vectorize. */
+static short floatToShort(float value) {
+  int rounded = (int)(value + copysignf(0.5f, value));
+
+  rounded = rounded > 32767 ? 32767 : rounded;
+  rounded = rounded < -32768 ? -32768 : rounded;
+  return (short)rounded;
+}
+
 /* Get the speed of the stream. */
 float sonicGetSpeed(sonicStream stream) { return stream->speed; }
 
 /* Set the speed of the stream. */
 void sonicSetSpeed(sonicStream stream, float speed) {
   stream->speed = CLAMP(speed, SONIC_MIN_SPEED, SONIC_MAX_SPEED);
+  if (stream->rtMaxBlock > 0) {
+    /* Real-time streams are only sized for the speeds they were created for. */
+    stream->speed = CLAMP(stream->speed, stream->rtMinSpeed, stream->rtMaxSpeed);
+  }
 }
 
 /* Get the pitch of the stream. */
@@ -327,20 +489,288 @@ void sonicSetVolume(sonicStream stream, float volume) {
   stream->volume = CLAMP(volume, SONIC_MIN_VOLUME, SONIC_MAX_VOLUME);
 }
 
-/* Free stream buffers. */
-static void freeStreamBuffers(sonicStream stream) {
-  if (stream->inputBuffer != NULL) {
-    sonicFree(stream->inputBuffer);
+/* Free the FFT pitch search state. */
+static void freeFftBuffers(sonicStream stream) {
+  if (stream->fftBitReverse != NULL) {
+    streamFree(stream, stream->fftBitReverse);
+  }
+  if (stream->fftCos != NULL) {
+    streamFree(stream, stream->fftCos);
   }
-  if (stream->outputBuffer != NULL) {
-    sonicFree(stream->outputBuffer);
+  if (stream->fftSin != NULL) {
+    streamFree(stream, stream->fftSin);
   }
-  if (stream->pitchBuffer != NULL) {
-    sonicFree(stream->pitchBuffer);
+  if (stream->fftReal != NULL) {
+    streamFree(stream, stream->fftReal);
+  }
+  if (stream->fftImag != NULL) {
+    streamFree(stream, stream->fftImag);
+  }
+  if (stream->fftEnergy != NULL) {
+    streamFree(stream, stream->fftEnergy);
+  }
+  stream->fftBitReverse = NULL;
+  stream->fftCos = NULL;
+  stream->fftSin = NULL;
+  stream->fftReal = NULL;
+  stream->fftImag = NULL;
+  stream->fftEnergy = NULL;
+  stream->fftSize = 0;
+}
+
+/* Build the FFT plan (bit reversal and twiddle tables) and work buffers for
+   the current maxPeriod.  Return 0 if out of memory. */
+static int allocateFftBuffers(sonicStream stream) {
+  int size = 1, bits = 0;
+  int i, j;
+
+  freeFftBuffers(stream);
+  while (size < 2 * stream->maxPeriod) {
+    size <<= 1;
+    bits++;
+  }
+  stream->fftBitReverse = (int*)streamCalloc(stream, size, sizeof(int));
+  stream->fftCos = (double*)streamCalloc(stream, size, sizeof(double));
+  stream->fftSin = (double*)streamCalloc(stream, size, sizeof(double));
+  stream->fftReal = (double*)streamCalloc(stream, size, sizeof(double));
+  stream->fftImag = (double*)streamCalloc(stream, size, sizeof(double));
+  stream->fftEnergy = (long long*)streamCalloc(stream, stream->maxRequired + 1,
+                                               sizeof(long long));
+  if (stream->fftBitReverse == NULL || stream->fftCos == NULL ||
+      stream->fftSin == NULL || stream->fftReal == NULL ||
+      stream->fftImag == NULL || stream->fftEnergy == NULL) {
+    freeFftBuffers(stream);
+    return 0;
+  }
+  for (i = 0; i < size; i++) {
+    int r = 0;
+    for (j = 0; j < bits; j++) {
+      r |= ((i >> j) & 1) << (bits - 1 - j);
+    }
+    stream->fftBitReverse[i] = r;
+  }
+  /* Laid out stage by stage so the butterfly loop reads them contiguously. */
+  for (j = 1; j < size; j <<= 1) {
+    for (i = 0; i < j; i++) {
+      stream->fftCos[j - 1 + i] = cos(M_PI * i / j);
+      stream->fftSin[j - 1 + i] = -sin(M_PI * i / j);
+    }
+  }
+  stream->fftSize = size;
+  return 1;
+}
+
+/* Get the pitch period estimator. */
+int sonicGetPitchMethod(sonicStream stream) { return stream->pitchMethod; }
+
+/* Select the pitch period estimator. */
+int sonicSetPitchMethod(sonicStream stream, int method) {
+  if (method == SONIC_PITCH_FFT) {
+    if (stream->fftSize == 0 && !allocateFftBuffers(stream)) {
+      return 0;
+    }
+    stream->pitchMethod = SONIC_PITCH_FFT;
+  } else {
+    freeFftBuffers(stream);
+    stream->pitchMethod = SONIC_PITCH_AMDF;
+  }
+  return 1;
+}
+
+/* Get the overlap-add crossfade curve. */
+int sonicGetOverlapCurve(sonicStream stream) { return stream->overlapCurve; }
+
+/* Set the overlap-add crossfade curve.  The cached gain tables were built for
+   the old one, so drop them. */
+void sonicSetOverlapCurve(sonicStream stream, int curve) {
+  curve = curve == SONIC_CURVE_EQUAL_POWER ? curve : SONIC_CURVE_LINEAR;
+  if (curve != stream->overlapCurve) {
+    stream->overlapCurve = curve;
+    memset(stream->rampLength, 0, sizeof(stream->rampLength));
+  }
+}
+
+/* Make room for numSamples frames of frameBytes bytes after the `used` live
+   frames at *start, inside the allocation *base of *size frames.  Consumers
+   advance *start instead of moving what is left down, so this only slides the
+   live frames back to *base once the tail reaches the end.  Unless that leaves
+   half the allocation free it grows as well, which keeps the cost of sliding
+   proportional to the frames that passed through the buffer.  The first
+   allocation is exactly numSamples frames, and real-time streams never grow.
+   Return 0 if we are out of memory and there is no room. */
+static int reserveBytes(sonicStream stream, void** base, void** start,
+                        int* size, int used, int numSamples, int frameBytes) {
+  int needed = used + numSamples;
+  int newSize;
+  void* newBase;
+
+  if (*base != NULL &&
+      ((char*)*start - (char*)*base) / frameBytes + needed <= *size) {
+    return 1;
+  }
+  if (*base == NULL) {
+    *base = streamCalloc(stream, numSamples, frameBytes);
+    *start = *base;
+    *size = *base != NULL ? numSamples : 0;
+    return *base != NULL;
+  }
+  if (*start != *base && used > 0) {
+    memmove(*base, *start, (size_t)used * frameBytes);
+  }
+  *start = *base;
+  if (stream->rtMaxBlock > 0) {
+    if (needed > *size) {
+      /* Used beyond what it was created for: refuse rather than allocate. */
+      reportAllocation(stream, (long)(needed - *size) * frameBytes);
+      return 0;
+    }
+    return 1;
+  }
+  if (2 * needed <= *size) {
+    return 1;
+  }
+  newSize = *size + (*size >> 1) + numSamples;
+  if (newSize < 2 * needed) {
+    newSize = 2 * needed;
+  }
+  newBase = sonicRealloc(*base, *size, newSize, frameBytes);
+  if (newBase == NULL) {
+    /* Growing was only to make sliding rarer. */
+    return needed <= *size;
+  }
+  *base = newBase;
+  *start = newBase;
+  *size = newSize;
+  return 1;
+}
+
+/* reserveBytes for a buffer of frames of `width` shorts. */
+static int reserveFrames(sonicStream stream, short** base, short** start,
+                         int* size, int used, int numSamples, int width) {
+  void* b = *base;
+  void* s = *start;
+  int ok = reserveBytes(stream, &b, &s, size, used, numSamples,
+                        width * sizeof(short));
+
+  *base = (short*)b;
+  *start = (short*)s;
+  return ok;
+}
+
+/* reserveBytes for a buffer of frames of `width` floats. */
+static int reserveFloatFrames(sonicStream stream, float** base, float** start,
+                              int* size, int used, int numSamples, int width) {
+  void* b = *base;
+  void* s = *start;
+  int ok = reserveBytes(stream, &b, &s, size, used, numSamples,
+                        width * sizeof(float));
+
+  *base = (float*)b;
+  *start = (float*)s;
+  return ok;
+}
+
+/* Free the decimation pyramid. */
+static void freePyramid(sonicStream stream) {
+  int k;
+
+  for (k = 0; k < SONIC_PYRAMID_LEVELS; k++) {
+    if (stream->pyramidBase[k] != NULL) {
+      streamFree(stream, stream->pyramidBase[k]);
+    }
+    stream->pyramidBase[k] = NULL;
+    stream->pyramid[k] = NULL;
+    stream->pyramidSize[k] = 0;
+  }
+}
+
+/* Empty the decimation pyramid, as when the input buffer is emptied. */
+static void resetPyramid(sonicStream stream) {
+  int k;
+
+  for (k = 0; k < SONIC_PYRAMID_LEVELS; k++) {
+    stream->pyramid[k] = stream->pyramidBase[k];
+    stream->pyramidCount[k] = 0;
+    stream->pyramidPhase[k] = 0;
+    stream->pyramidSum[k] = 0;
+    stream->pyramidFill[k] = 0;
+  }
+}
+
+/* The number of values level k gains from numSamples more input frames.
+   Level 0 is only needed with more than one channel, and levels 1 and 2 only
+   when they decimate. */
+static int pyramidValues(sonicStream stream, int numChannels, int k,
+                         int numSamples) {
+  int skip = stream->pyramidSkip[k];
+
+  if (k == 0) {
+    return numChannels > 1 ? numSamples : 0;
+  }
+  if (skip == 1) {
+    return 0;
+  }
+  return (stream->pyramidPhase[k] + stream->numInputSamples + numSamples) /
+             skip -
+         stream->pyramidCount[k];
+}
+
+/* Make room in the pyramid for numSamples more input frames. */
+static int reservePyramid(sonicStream stream, int numSamples) {
+  int k, values;
+
+  for (k = 0; k < SONIC_PYRAMID_LEVELS; k++) {
+    values = pyramidValues(stream, stream->numChannels, k, numSamples);
+    if (values > 0 &&
+        !reserveFrames(stream, &stream->pyramidBase[k], &stream->pyramid[k],
+                       &stream->pyramidSize[k], stream->pyramidCount[k],
+                       values, 1)) {
+      return 0;
+    }
   }
-  if (stream->downSampleBuffer != NULL) {
-    sonicFree(stream->downSampleBuffer);
+  return 1;
+}
+
+/* Choose the pyramid's decimation factors.  Level 2 brings the rate down to
+   about SONIC_AMDF_FREQ, as the quality 0 search always has; level 1 sits
+   between it and the full rate.  A factor of 1 means the level is absent. */
+static void choosePyramidSkips(sonicStream stream, int sampleRate) {
+  int skip = 1;
+
+  if (sampleRate > SONIC_AMDF_FREQ) {
+    skip = sampleRate / SONIC_AMDF_FREQ;
   }
+  stream->pyramidSkip[0] = 1;
+  stream->pyramidSkip[2] = skip;
+  stream->pyramidSkip[1] = skip >= 8 ? skip >> 2 : 1;
+}
+
+/* Free stream buffers. */
+static void freeStreamBuffers(sonicStream stream) {
+  freeFftBuffers(stream);
+  if (stream->inputBase != NULL) {
+    streamFree(stream, stream->inputBase);
+  }
+  if (stream->outputBase != NULL) {
+    streamFree(stream, stream->outputBase);
+  }
+  if (stream->pitchBase != NULL) {
+    streamFree(stream, stream->pitchBase);
+  }
+  stream->inputBase = stream->inputBuffer = NULL;
+  stream->outputBase = stream->outputBuffer = NULL;
+  stream->pitchBase = stream->pitchBuffer = NULL;
+  if (stream->rampTables != NULL) {
+    streamFree(stream, stream->rampTables);
+  }
+  stream->rampTables = NULL;
+  if (stream->rateBank != NULL) {
+    streamFree(stream, stream->rateBank);
+  }
+  stream->rateBank = NULL;
+  freePyramid(stream);
+  /* Everything carved from the arena is gone now. */
+  stream->arenaUsed = stream->arenaStart;
 }
 
 /* Destroy the sonic stream. */
@@ -351,16 +781,72 @@ void sonicDestroyStream(sonicStream stream) {
   }
 #endif /* SONIC_SPECTROGRAM */
   freeStreamBuffers(stream);
+  /* A real-time stream's arena starts with the stream, so this frees both. */
   sonicFree(stream);
 }
 
-/* Compute the number of samples to skip to down-sample the input. */
-static int computeSkip(sonicStream stream, int sampleRate) {
-  int skip = 1;
-  if (sampleRate > SONIC_AMDF_FREQ && stream->quality == 0) {
-    skip = sampleRate / SONIC_AMDF_FREQ;
+/* Choose the input, output and pitch buffer sizes.  Other streams get 25% more
+   than needed, so they hopefully won't grow.  Real-time streams get their
+   worst case, given that each write is at most rtMaxBlock frames and that
+   the output is read empty before the next write, except that a flush may
+   come with one write's output still unread.  Each write then leaves less
+   than maxRequired frames of input behind, and turns what it consumes into
+   at most 1 / speed times as much output, plus up to a pitch period or two
+   of error.  Pitch and rate must stay at 1: the pitch buffer is not sized
+   for them. */
+static void chooseBufferSizes(sonicStream stream, int maxRequired) {
+  float minSpeed = stream->rtMinSpeed < 1.0f ? stream->rtMinSpeed : 1.0f;
+  int maxBlock = stream->rtMaxBlock;
+
+  stream->pitchBufferSize = maxRequired + (maxRequired >> 2);
+  if (maxBlock == 0) {
+    stream->inputBufferSize = stream->pitchBufferSize;
+    stream->outputBufferSize = stream->pitchBufferSize;
+    return;
   }
-  return skip;
+  /* sonicFlushStream adds 2 * maxRequired frames of silence. */
+  stream->inputBufferSize =
+      maxRequired + (maxBlock > 2 * maxRequired ? maxBlock : 2 * maxRequired);
+  /* Unread output of a write, plus a flush of maxRequired frames of input
+     and the silence. */
+  stream->outputBufferSize =
+      (int)((maxBlock + 4 * maxRequired) / minSpeed) + 2 * maxRequired;
+}
+
+/* Room the buffers of a stream need.  The pyramid gets one coarse group more
+   than the input buffer, for groups straddling either end. */
+static int pyramidReserve(sonicStream stream) {
+  return stream->inputBufferSize + stream->pyramidSkip[2];
+}
+
+/* Floats in the rate change's filter bank. */
+static long rateBankFloats(void) {
+  return (long)SONIC_RATE_MAX_PHASES * SINC_FILTER_POINTS;
+}
+
+/* Floats in the overlap-add gain tables of a stream. */
+static long rampTableFloats(sonicStream stream) {
+  return (long)SONIC_RAMP_SLOTS * 2 * stream->maxPeriod;
+}
+
+/* Bytes of arena the buffers take, once maxPeriod is set and
+   chooseBufferSizes and choosePyramidSkips have been run on a fresh stream. */
+static long bufferBytes(sonicStream stream, int numChannels) {
+  long frameBytes = sizeof(short) * numChannels;
+  long floatFrameBytes = sizeof(float) * numChannels;
+  long bytes = arenaAlign(stream->inputBufferSize * frameBytes) +
+               arenaAlign(stream->outputBufferSize * floatFrameBytes) +
+               arenaAlign(stream->pitchBufferSize * floatFrameBytes) +
+               arenaAlign(rampTableFloats(stream) * sizeof(float)) +
+               arenaAlign(rateBankFloats() * sizeof(float));
+  int k;
+
+  for (k = 0; k < SONIC_PYRAMID_LEVELS; k++) {
+    bytes += arenaAlign(
+        pyramidValues(stream, numChannels, k, pyramidReserve(stream)) *
+        sizeof(short));
+  }
+  return bytes;
 }
 
 /* Allocate stream buffers. */
@@ -370,50 +856,89 @@ static int allocateStreamBuffers(sonicStream stream, int sampleRate,
   int maxPeriod = sampleRate / SONIC_MIN_PITCH;
   int maxRequired = 2 * maxPeriod;
 
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->inputBufferSize = maxRequired + (maxRequired >> 2);
-
-  stream->inputBuffer =
-      (short*)sonicCalloc(stream->inputBufferSize, sizeof(short) * numChannels);
-  if (stream->inputBuffer == NULL) {
+  chooseBufferSizes(stream, maxRequired);
+  stream->inputBase = (short*)streamCalloc(stream, stream->inputBufferSize,
+                                           sizeof(short) * numChannels);
+  if (stream->inputBase == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->outputBufferSize = maxRequired + (maxRequired >> 2);
-  stream->outputBuffer = (short*)sonicCalloc(stream->outputBufferSize,
-                                             sizeof(short) * numChannels);
-  if (stream->outputBuffer == NULL) {
+  stream->inputBuffer = stream->inputBase;
+  stream->outputBase = (float*)streamCalloc(stream, stream->outputBufferSize,
+                                            sizeof(float) * numChannels);
+  if (stream->outputBase == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->pitchBufferSize = maxRequired + (maxRequired >> 2);
-  stream->pitchBuffer =
-      (short*)sonicCalloc(stream->pitchBufferSize, sizeof(short) * numChannels);
-  if (stream->pitchBuffer == NULL) {
-    sonicDestroyStream(stream);
-    return 0;
-  }
-  int downSampleBufferSize = maxRequired;
-  stream->downSampleBuffer =
-      (short*)sonicCalloc(downSampleBufferSize, sizeof(short));
-  if (stream->downSampleBuffer == NULL) {
+  stream->outputBuffer = stream->outputBase;
+  stream->pitchBase = (float*)streamCalloc(stream, stream->pitchBufferSize,
+                                           sizeof(float) * numChannels);
+  if (stream->pitchBase == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
+  stream->pitchBuffer = stream->pitchBase;
+  stream->numInputSamples = 0;
+  stream->numOutputSamples = 0;
+  stream->numPitchSamples = 0;
   stream->sampleRate = sampleRate;
   stream->samplePeriod = 1.0 / sampleRate;
   stream->numChannels = numChannels;
+  choosePyramidSkips(stream, sampleRate);
+  resetPyramid(stream);
+  if (!reservePyramid(stream, pyramidReserve(stream))) {
+    sonicDestroyStream(stream);
+    return 0;
+  }
   stream->oldRatePosition = 0;
   stream->newRatePosition = 0;
   stream->minPeriod = minPeriod;
   stream->maxPeriod = maxPeriod;
   stream->maxRequired = maxRequired;
   stream->prevPeriod = 0;
+  stream->rampTables =
+      (float*)streamCalloc(stream, rampTableFloats(stream), sizeof(float));
+  if (stream->rampTables == NULL) {
+    sonicDestroyStream(stream);
+    return 0;
+  }
+  memset(stream->rampLength, 0, sizeof(stream->rampLength));
+  stream->rateBank =
+      (float*)streamCalloc(stream, rateBankFloats(), sizeof(float));
+  if (stream->rateBank == NULL) {
+    sonicDestroyStream(stream);
+    return 0;
+  }
+  stream->rateNewRate = 0;
+  /* After a sample rate change, fall back to AMDF rather than fail. */
+  if (stream->pitchMethod == SONIC_PITCH_FFT && !allocateFftBuffers(stream)) {
+    stream->pitchMethod = SONIC_PITCH_AMDF;
+  }
   return 1;
 }
 
+/* Allocate the buffers of a zeroed stream and set the defaults.  Return NULL
+   if we are out of memory, having destroyed the stream. */
+static sonicStream initStream(sonicStream stream, int sampleRate,
+                              int numChannels) {
+  if (!allocateStreamBuffers(stream, sampleRate, numChannels)) {
+    return NULL;
+  }
+  stream->speed = 1.0f;
+  stream->pitch = 1.0f;
+  stream->volume = 1.0f;
+  stream->rate = 1.0f;
+  stream->oldRatePosition = 0;
+  stream->newRatePosition = 0;
+  stream->quality = 0;
+#ifdef SONIC_USE_SIN
+  stream->overlapCurve = SONIC_CURVE_EQUAL_POWER;
+#else
+  stream->overlapCurve = SONIC_CURVE_LINEAR;
+#endif
+  return stream;
+}
+
 /* Create a sonic stream.  Return NULL only if we are out of memory and cannot
    allocate the stream. */
 sonicStream sonicCreateStream(int sampleRate, int numChannels) {
@@ -425,16 +950,51 @@ sonicStream sonicCreateStream(int sampleRate, int numChannels) {
   if (stream == NULL) {
     return NULL;
   }
-  if (!allocateStreamBuffers(stream, sampleRate, numChannels)) {
+  return initStream(stream, sampleRate, numChannels);
+}
+
+/* Create a sonic stream for a real-time thread.  The stream and its
+   worst-case buffers are one allocation, so writing, reading and flushing
+   never allocate.  Return NULL if we are out of memory. */
+sonicStream sonicCreateStreamRT(int sampleRate, int numChannels, int maxBlock,
+                                float minSpeed, float maxSpeed) {
+  struct sonicStreamStruct sizing;
+  long arenaStart = arenaAlign(sizeof(struct sonicStreamStruct));
+  long arenaSize;
+  unsigned char* arena;
+  sonicStream stream;
+
+  sampleRate = CLAMP(sampleRate, SONIC_MIN_SAMPLE_RATE, SONIC_MAX_SAMPLE_RATE);
+  numChannels = CLAMP(numChannels, SONIC_MIN_CHANNELS, SONIC_MAX_CHANNELS);
+  minSpeed = CLAMP(minSpeed, SONIC_MIN_SPEED, SONIC_MAX_SPEED);
+  maxSpeed = CLAMP(maxSpeed, minSpeed, SONIC_MAX_SPEED);
+  if (maxBlock < 1) {
+    maxBlock = 1;
+  }
+  memset(&sizing, 0, sizeof(sizing));
+  sizing.rtMaxBlock = maxBlock;
+  sizing.rtMinSpeed = minSpeed;
+  sizing.maxPeriod = sampleRate / SONIC_MIN_PITCH;
+  chooseBufferSizes(&sizing, 2 * sizing.maxPeriod);
+  choosePyramidSkips(&sizing, sampleRate);
+  arenaSize = arenaStart + bufferBytes(&sizing, numChannels);
+  arena = (unsigned char*)sonicCalloc(arenaSize, 1);
+  if (arena == NULL) {
     return NULL;
   }
-  stream->speed = 1.0f;
-  stream->pitch = 1.0f;
-  stream->volume = 1.0f;
-  stream->rate = 1.0f;
-  stream->oldRatePosition = 0;
-  stream->newRatePosition = 0;
-  stream->quality = 0;
+  stream = (sonicStream)arena;
+  stream->arena = arena;
+  stream->arenaSize = arenaSize;
+  stream->arenaStart = arenaStart;
+  stream->arenaUsed = arenaStart;
+  stream->rtMaxBlock = maxBlock;
+  stream->rtMinSpeed = minSpeed;
+  stream->rtMaxSpeed = maxSpeed;
+  if (initStream(stream, sampleRate, numChannels) == NULL) {
+    return NULL;
+  }
+  sonicSetSpeed(stream, 1.0f);
+  stream->realtime = 1;
   return stream;
 }
 
@@ -462,34 +1022,85 @@ void sonicSetNumChannels(sonicStream stream, int numChannels) {
 
 /* Enlarge the output buffer if needed. */
 static int enlargeOutputBufferIfNeeded(sonicStream stream, int numSamples) {
-  int outputBufferSize = stream->outputBufferSize;
-
-  if (stream->numOutputSamples + numSamples > outputBufferSize) {
-    stream->outputBufferSize += (outputBufferSize >> 1) + numSamples;
-    stream->outputBuffer = (short*)sonicRealloc(
-        stream->outputBuffer, outputBufferSize, stream->outputBufferSize,
-        sizeof(short) * stream->numChannels);
-    if (stream->outputBuffer == NULL) {
-      return 0;
+  return reserveFloatFrames(stream, &stream->outputBase,
+                            &stream->outputBuffer, &stream->outputBufferSize,
+                            stream->numOutputSamples, numSamples,
+                            stream->numChannels);
+}
+
+/* Enlarge the input buffer, and the pyramid that follows it, if needed. */
+static int enlargeInputBufferIfNeeded(sonicStream stream, int numSamples) {
+  if (!reserveFrames(stream, &stream->inputBase, &stream->inputBuffer,
+                     &stream->inputBufferSize, stream->numInputSamples,
+                     numSamples, stream->numChannels)) {
+    return 0;
+  }
+  return reservePyramid(stream, numSamples);
+}
+
+/* Extend the decimation pyramid over numSamples frames just written to the
+   input buffer, starting at frame `first`.  Values are the truncated mean of
+   the raw samples they cover. */
+static void extendPyramid(sonicStream stream, int first, int numSamples) {
+  int numChannels = stream->numChannels;
+  short* samples = stream->inputBuffer + first * numChannels;
+  short* mono = stream->pyramid[0];
+  int i, j, k, skip, frameSum;
+
+  for (i = 0; i < numSamples; i++) {
+    frameSum = 0;
+    for (j = 0; j < numChannels; j++) {
+      frameSum += *samples++;
+    }
+    if (numChannels > 1) {
+      mono[first + i] = frameSum / numChannels;
+    }
+    for (k = 1; k < SONIC_PYRAMID_LEVELS; k++) {
+      skip = stream->pyramidSkip[k];
+      if (skip == 1) {
+        continue;
+      }
+      stream->pyramidSum[k] += frameSum;
+      if (++stream->pyramidFill[k] == skip) {
+        stream->pyramid[k][stream->pyramidCount[k]++] =
+            stream->pyramidSum[k] / (numChannels * skip);
+        stream->pyramidSum[k] = 0;
+        stream->pyramidFill[k] = 0;
+      }
     }
   }
-  return 1;
+  if (numChannels > 1) {
+    stream->pyramidCount[0] = first + numSamples;
+  }
 }
 
-/* Enlarge the input buffer if needed. */
-static int enlargeInputBufferIfNeeded(sonicStream stream, int numSamples) {
-  int inputBufferSize = stream->inputBufferSize;
-
-  if (stream->numInputSamples + numSamples > inputBufferSize) {
-    stream->inputBufferSize += (inputBufferSize >> 1) + numSamples;
-    stream->inputBuffer = (short*)sonicRealloc(
-        stream->inputBuffer, inputBufferSize, stream->inputBufferSize,
-        sizeof(short) * stream->numChannels);
-    if (stream->inputBuffer == NULL) {
-      return 0;
+/* Drop the pyramid's view of the first `position` input frames.  Groups that
+   straddle the new start of the buffer are kept, and the phase records how far
+   back they reach. */
+static void trimPyramid(sonicStream stream, int position) {
+  int k, skip, groups;
+
+  if (stream->numChannels > 1 && stream->pyramidCount[0] > position) {
+    stream->pyramidCount[0] -= position;
+    stream->pyramid[0] += position;
+  } else {
+    stream->pyramidCount[0] = 0;
+    stream->pyramid[0] = stream->pyramidBase[0];
+  }
+  for (k = 1; k < SONIC_PYRAMID_LEVELS; k++) {
+    skip = stream->pyramidSkip[k];
+    if (skip == 1) {
+      continue;
+    }
+    groups = (stream->pyramidPhase[k] + position) / skip;
+    stream->pyramidPhase[k] += position - groups * skip;
+    stream->pyramidCount[k] -= groups;
+    if (stream->pyramidCount[k] > 0) {
+      stream->pyramid[k] += groups;
+    } else {
+      stream->pyramid[k] = stream->pyramidBase[k];
     }
   }
-  return 1;
 }
 
 /* Update stream->numInputSamples, and update stream->inputPlayTime.  Call this
@@ -498,6 +1109,7 @@ static int enlargeInputBufferIfNeeded(sonicStream stream, int numSamples) {
 static void updateNumInputSamples(sonicStream stream, int numSamples) {
   float speed = stream->speed / stream->pitch;
 
+  extendPyramid(stream, stream->numInputSamples, numSamples);
   stream->numInputSamples += numSamples;
   stream->inputPlayTime += numSamples * stream->samplePeriod / speed;
 }
@@ -563,10 +1175,11 @@ static void removeInputSamples(sonicStream stream, int position) {
   int remainingSamples = stream->numInputSamples - position;
 
   if (remainingSamples > 0) {
-    memmove(stream->inputBuffer,
-            stream->inputBuffer + position * stream->numChannels,
-            remainingSamples * sizeof(short) * stream->numChannels);
+    stream->inputBuffer += position * stream->numChannels;
+  } else {
+    stream->inputBuffer = stream->inputBase;
   }
+  trimPyramid(stream, position);
   /* If we play 3/4ths of the samples, then the expected play time of the
      remaining samples is 1/4th of the original expected play time. */
   stream->inputPlayTime =
@@ -574,17 +1187,13 @@ static void removeInputSamples(sonicStream stream, int position) {
   stream->numInputSamples = remainingSamples;
 }
 
-/* Copy from the input buffer to the output buffer, and remove the samples from
-   the input buffer. */
-static int copyInputToOutput(sonicStream stream, int numSamples) {
-  if (!enlargeOutputBufferIfNeeded(stream, numSamples)) {
-    return 0;
+/* Convert count shorts to output floats. */
+static void shortsToFloats(float* out, const short* samples, int count) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    out[i] = samples[i];
   }
-  memcpy(stream->outputBuffer + stream->numOutputSamples * stream->numChannels,
-         stream->inputBuffer, numSamples * sizeof(short) * stream->numChannels);
-  stream->numOutputSamples += numSamples;
-  removeInputSamples(stream, numSamples);
-  return 1;
 }
 
 /* Copy from samples to the output buffer */
@@ -592,39 +1201,53 @@ static int copyToOutput(sonicStream stream, short* samples, int numSamples) {
   if (!enlargeOutputBufferIfNeeded(stream, numSamples)) {
     return 0;
   }
-  memcpy(stream->outputBuffer + stream->numOutputSamples * stream->numChannels,
-         samples, numSamples * sizeof(short) * stream->numChannels);
+  shortsToFloats(
+      stream->outputBuffer + stream->numOutputSamples * stream->numChannels,
+      samples, numSamples * stream->numChannels);
   stream->numOutputSamples += numSamples;
   return 1;
 }
 
+/* Copy from the input buffer to the output buffer, and remove the samples from
+   the input buffer. */
+static int copyInputToOutput(sonicStream stream, int numSamples) {
+  if (!copyToOutput(stream, stream->inputBuffer, numSamples)) {
+    return 0;
+  }
+  removeInputSamples(stream, numSamples);
+  return 1;
+}
+
+/* Remove samples that have been read from the output buffer. */
+static void removeOutputSamples(sonicStream stream, int numSamples) {
+  stream->numOutputSamples -= numSamples;
+  if (stream->numOutputSamples > 0) {
+    stream->outputBuffer += numSamples * stream->numChannels;
+  } else {
+    stream->outputBuffer = stream->outputBase;
+  }
+}
+
 /* Read data out of the stream.  Sometimes no data will be available, and zero
    is returned, which is not an error condition. */
 int sonicReadFloatFromStream(sonicStream stream, float* samples,
                              int maxSamples) {
   int numSamples = stream->numOutputSamples;
-  int remainingSamples = 0;
-  short* buffer;
-  int count;
+  float* buffer;
+  int i, count;
 
   if (numSamples == 0) {
     return 0;
   }
   if (numSamples > maxSamples) {
-    remainingSamples = numSamples - maxSamples;
     numSamples = maxSamples;
   }
   buffer = stream->outputBuffer;
   count = numSamples * stream->numChannels;
-  while (count--) {
-    *samples++ = (*buffer++) / 32767.0f;
+  for (i = 0; i < count; i++) {
+    samples[i] = buffer[i] * (1.0f / 32767.0f);
   }
-  if (remainingSamples > 0) {
-    memmove(stream->outputBuffer,
-            stream->outputBuffer + numSamples * stream->numChannels,
-            remainingSamples * sizeof(short) * stream->numChannels);
-  }
-  stream->numOutputSamples = remainingSamples;
+  removeOutputSamples(stream, numSamples);
   return numSamples;
 }
 
@@ -633,23 +1256,21 @@ int sonicReadFloatFromStream(sonicStream stream, float* samples,
 int sonicReadShortFromStream(sonicStream stream, short* samples,
                              int maxSamples) {
   int numSamples = stream->numOutputSamples;
-  int remainingSamples = 0;
+  float* buffer;
+  int i, count;
 
   if (numSamples == 0) {
     return 0;
   }
   if (numSamples > maxSamples) {
-    remainingSamples = numSamples - maxSamples;
     numSamples = maxSamples;
   }
-  memcpy(samples, stream->outputBuffer,
-         numSamples * sizeof(short) * stream->numChannels);
-  if (remainingSamples > 0) {
-    memmove(stream->outputBuffer,
-            stream->outputBuffer + numSamples * stream->numChannels,
-            remainingSamples * sizeof(short) * stream->numChannels);
+  buffer = stream->outputBuffer;
+  count = numSamples * stream->numChannels;
+  for (i = 0; i < count; i++) {
+    samples[i] = floatToShort(buffer[i]);
   }
-  stream->numOutputSamples = remainingSamples;
+  removeOutputSamples(stream, numSamples);
   return numSamples;
 }
 
@@ -658,28 +1279,21 @@ int sonicReadShortFromStream(sonicStream stream, short* samples,
 int sonicReadUnsignedCharFromStream(sonicStream stream, unsigned char* samples,
                                     int maxSamples) {
   int numSamples = stream->numOutputSamples;
-  int remainingSamples = 0;
-  short* buffer;
+  float* buffer;
   int count;
 
   if (numSamples == 0) {
     return 0;
   }
   if (numSamples > maxSamples) {
-    remainingSamples = numSamples - maxSamples;
     numSamples = maxSamples;
   }
   buffer = stream->outputBuffer;
   count = numSamples * stream->numChannels;
   while (count--) {
-    *samples++ = (char)((*buffer++) >> 8) + 128;
+    *samples++ = (char)(floatToShort(*buffer++) >> 8) + 128;
   }
-  if (remainingSamples > 0) {
-    memmove(stream->outputBuffer,
-            stream->outputBuffer + numSamples * stream->numChannels,
-            remainingSamples * sizeof(short) * stream->numChannels);
-  }
-  stream->numOutputSamples = remainingSamples;
+  removeOutputSamples(stream, numSamples);
   return numSamples;
 }
 
@@ -696,11 +1310,12 @@ int sonicFlushStream(sonicStream stream) {
       (int)((remainingSamples / speed + stream->numPitchSamples) / rate + 0.5f);
 
   /* Add enough silence to flush both input and pitch buffers. */
-  if (!enlargeInputBufferIfNeeded(stream, remainingSamples + 2 * maxRequired)) {
+  if (!enlargeInputBufferIfNeeded(stream, 2 * maxRequired)) {
     return 0;
   }
   memset(stream->inputBuffer + remainingSamples * stream->numChannels, 0,
          2 * maxRequired * sizeof(short) * stream->numChannels);
+  extendPyramid(stream, remainingSamples, 2 * maxRequired);
   stream->numInputSamples += 2 * maxRequired;
   if (!sonicWriteShortToStream(stream, NULL, 0)) {
     return 0;
@@ -711,35 +1326,147 @@ int sonicFlushStream(sonicStream stream) {
   }
   /* Empty input and pitch buffers */
   stream->numInputSamples = 0;
+  stream->inputBuffer = stream->inputBase;
+  resetPyramid(stream);
   stream->inputPlayTime = 0.0f;
   stream->timeError = 0.0f;
   stream->numPitchSamples = 0;
+  stream->pitchBuffer = stream->pitchBase;
   return 1;
 }
 
+/* Drop every buffered input, pitch and output sample without producing any
+   output, as if the stream had just been created.  Speed, pitch, rate, volume
+   and quality are kept. */
+void sonicClearStream(sonicStream stream) {
+  stream->numInputSamples = 0;
+  stream->inputBuffer = stream->inputBase;
+  resetPyramid(stream);
+  stream->numPitchSamples = 0;
+  stream->pitchBuffer = stream->pitchBase;
+  stream->numOutputSamples = 0;
+  stream->outputBuffer = stream->outputBase;
+  stream->inputPlayTime = 0.0f;
+  stream->timeError = 0.0f;
+  stream->oldRatePosition = 0;
+  stream->newRatePosition = 0;
+  stream->prevPeriod = 0;
+}
+
 /* Return the number of samples in the output buffer */
 int sonicSamplesAvailable(sonicStream stream) {
   return stream->numOutputSamples;
 }
 
-/* If skip is greater than one, average skip samples together and write them to
-   the down-sample buffer.  If numChannels is greater than one, mix the channels
-   together as we down sample. */
-static void downSampleInput(sonicStream stream, short* samples, int skip) {
-  int numSamples = stream->maxRequired / skip;
-  int samplesPerValue = stream->numChannels * skip;
-  int i, j;
-  int value;
-  short* downSamples = stream->downSampleBuffer;
+/* Return the number of input samples not yet turned into output */
+int sonicSamplesPending(sonicStream stream) {
+  return stream->numInputSamples;
+}
+
+/* Sum of |s[i] - p[i]| over numSamples samples.  Each term fits in 16 bits
+   unsigned, and numSamples is at most a pitch period, so the sum fits in 32
+   bits: the vector versions below accumulate in 32-bit lanes and match this
+   one exactly. */
+static unsigned long amdfScalar(const short* s, const short* p,
+                                int numSamples) {
+  unsigned long diff = 0;
+  short sVal, pVal;
+  int i;
 
   for (i = 0; i < numSamples; i++) {
-    value = 0;
-    for (j = 0; j < samplesPerValue; j++) {
-      value += *samples++;
-    }
-    value /= samplesPerValue;
-    *downSamples++ = value;
+    sVal = s[i];
+    pVal = p[i];
+    diff += sVal >= pVal ? (unsigned short)(sVal - pVal)
+                         : (unsigned short)(pVal - sVal);
   }
+  return diff;
+}
+
+#ifdef SONIC_SIMD_SSE2
+/* max - min in 16-bit lanes is |s - p| modulo 2^16, which is exactly the
+   unsigned short the scalar loop adds. */
+static unsigned long amdfSSE2(const short* s, const short* p, int numSamples) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  __m128i a, b, d;
+  unsigned int lanes[4];
+  int i = 0;
+
+  for (; i + 8 <= numSamples; i += 8) {
+    a = _mm_loadu_si128((const __m128i*)(s + i));
+    b = _mm_loadu_si128((const __m128i*)(p + i));
+    d = _mm_sub_epi16(_mm_max_epi16(a, b), _mm_min_epi16(a, b));
+    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(d, zero));
+    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(d, zero));
+  }
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         amdfScalar(s + i, p + i, numSamples - i);
+}
+#endif /* SONIC_SIMD_SSE2 */
+
+#ifdef SONIC_SIMD_AVX2
+__attribute__((target("avx2")))
+static unsigned long amdfAVX2(const short* s, const short* p, int numSamples) {
+  __m256i acc = _mm256_setzero_si256();
+  __m256i a, b, d;
+  __m128i sum;
+  unsigned int lanes[4];
+  int i = 0;
+
+  for (; i + 16 <= numSamples; i += 16) {
+    a = _mm256_loadu_si256((const __m256i*)(s + i));
+    b = _mm256_loadu_si256((const __m256i*)(p + i));
+    d = _mm256_sub_epi16(_mm256_max_epi16(a, b), _mm256_min_epi16(a, b));
+    acc = _mm256_add_epi32(acc,
+                           _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)));
+    acc = _mm256_add_epi32(acc,
+                           _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)));
+  }
+  sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                      _mm256_extracti128_si256(acc, 1));
+  _mm_storeu_si128((__m128i*)lanes, sum);
+  return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         amdfScalar(s + i, p + i, numSamples - i);
+}
+
+static int sonicHasAVX2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif /* SONIC_SIMD_AVX2 */
+
+#ifdef SONIC_SIMD_NEON
+static unsigned long amdfNEON(const short* s, const short* p, int numSamples) {
+  uint32x4_t acc = vdupq_n_u32(0);
+  int i = 0;
+
+  for (; i + 8 <= numSamples; i += 8) {
+    int16x8_t d = vabdq_s16(vld1q_s16(s + i), vld1q_s16(p + i));
+    acc = vpadalq_u16(acc, vreinterpretq_u16_s16(d));
+  }
+  return (unsigned long)vaddvq_u32(acc) +
+         amdfScalar(s + i, p + i, numSamples - i);
+}
+#endif /* SONIC_SIMD_NEON */
+
+typedef unsigned long (*amdfFunc)(const short* s, const short* p,
+                                  int numSamples);
+
+/* Picks the widest kernel this CPU runs.  Cheap enough to do per search. */
+static amdfFunc chooseAmdf(void) {
+#if defined(SONIC_SIMD_AVX2)
+  if (sonicHasAVX2()) {
+    return amdfAVX2;
+  }
+#endif
+#if defined(SONIC_SIMD_SSE2)
+  return amdfSSE2;
+#elif defined(SONIC_SIMD_NEON)
+  return amdfNEON;
+#else
+  return amdfScalar;
+#endif
 }
 
 /* Find the best frequency match in the range, and given a sample skip multiple.
@@ -747,22 +1474,11 @@ static void downSampleInput(sonicStream stream, short* samples, int skip) {
 static int findPitchPeriodInRange(short* samples, int minPeriod, int maxPeriod,
                                   int* retMinDiff, int* retMaxDiff) {
   int period, bestPeriod = 0, worstPeriod = 255;
-  short* s;
-  short* p;
-  short sVal, pVal;
   unsigned long diff, minDiff = 1, maxDiff = 0;
-  int i;
+  amdfFunc amdf = chooseAmdf();
 
   for (period = minPeriod; period <= maxPeriod; period++) {
-    diff = 0;
-    s = samples;
-    p = samples + period;
-    for (i = 0; i < period; i++) {
-      sVal = *s++;
-      pVal = *p++;
-      diff += sVal >= pVal ? (unsigned short)(sVal - pVal)
-                           : (unsigned short)(pVal - sVal);
-    }
+    diff = amdf(samples, samples + period, period);
     /* Note that the highest number of samples we add into diff will be less
        than 256, since we skip samples.  Thus, diff is a 24 bit number, and
        we can safely multiply by numSamples without overflow */
@@ -780,6 +1496,158 @@ static int findPitchPeriodInRange(short* samples, int minPeriod, int maxPeriod,
   return bestPeriod;
 }
 
+/* One radix-2 stage over contiguous halves; written so compilers vectorize
+   the j loop. */
+static void fftButterflies(double* restrict ar, double* restrict ai,
+                           double* restrict br, double* restrict bi,
+                           const double* restrict wr,
+                           const double* restrict wi, int half) {
+  int j;
+
+  for (j = 0; j < half; j++) {
+    double xr = br[j] * wr[j] - bi[j] * wi[j];
+    double xi = br[j] * wi[j] + bi[j] * wr[j];
+    br[j] = ar[j] - xr;
+    bi[j] = ai[j] - xi;
+    ar[j] += xr;
+    ai[j] += xi;
+  }
+}
+
+/* In-place forward radix-2 FFT of the first n (fftSize or fftSize / 2)
+   values of fftReal/fftImag.  The twiddle tables serve both sizes, and the
+   bit reversal for fftSize / 2 is the fftSize one shifted down by a bit.
+   Inverses are done by the caller as conj(FFT(conj(x))), unscaled. */
+static void fftTransform(sonicStream stream, int n) {
+  double* re = stream->fftReal;
+  double* im = stream->fftImag;
+  int shift = n == stream->fftSize ? 0 : 1;
+  int i, j, half;
+
+  for (i = 0; i < n; i++) {
+    j = stream->fftBitReverse[i] >> shift;
+    if (j > i) {
+      double t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+  /* The first two stages have trivial twiddles (1 and -i); do them as one
+     radix-4 pass. */
+  for (i = 0; i < n; i += 4) {
+    double r0 = re[i] + re[i + 1], i0 = im[i] + im[i + 1];
+    double r1 = re[i] - re[i + 1], i1 = im[i] - im[i + 1];
+    double r2 = re[i + 2] + re[i + 3], i2 = im[i + 2] + im[i + 3];
+    double r3 = re[i + 2] - re[i + 3], i3 = im[i + 2] - im[i + 3];
+    re[i] = r0 + r2;
+    im[i] = i0 + i2;
+    re[i + 2] = r0 - r2;
+    im[i + 2] = i0 - i2;
+    re[i + 1] = r1 + i3;
+    im[i + 1] = i1 - r3;
+    re[i + 3] = r1 - i3;
+    im[i + 3] = i1 + r3;
+  }
+  for (half = 4; half < n; half <<= 1) {
+    const double* wr = stream->fftCos + half - 1;
+    const double* wi = stream->fftSin + half - 1;
+    for (i = 0; i < n; i += 2 * half) {
+      fftButterflies(re + i, im + i, re + i + half, im + i + half, wr, wi,
+                     half);
+    }
+  }
+}
+
+/* Store conj(E[k] + i O[k]) at bin k, given C[k] = a and C[n/2 - k] = b. */
+static void fftPackHalf(sonicStream stream, int n, int k, double ar,
+                        double ai, double br, double bi) {
+  double er = ar + br, ei = ai - bi; /* a + conj(b) */
+  double dr = ar - br, di = ai + bi; /* a - conj(b) */
+  double wr = stream->fftCos[n / 2 - 1 + k];
+  double wi = -stream->fftSin[n / 2 - 1 + k];
+  double or = dr * wr - di * wi, oi = dr * wi + di * wr;
+
+  stream->fftReal[k] = er - oi;
+  stream->fftImag[k] = -(ei + or);
+}
+
+/* FFT version of findPitchPeriodInRange.  Over a fixed window of W = maxPeriod
+   samples, the squared difference function is
+
+     d(P) = sum (s[i] - s[i+P])^2 = E(0) + E(P) - 2 r(P),  i < W
+
+   where E(P) is the energy of s[P..P+W) (prefix sums) and r(P) the cross
+   correlation of s[0..W) with s, all lags from one forward and one inverse
+   FFT.  x = s[0..W) and y = s[0..2W) are packed into one complex transform.
+   r is an integer and the FFT error is far below 0.5, so rounding makes d
+   exact.  Diffs are returned as RMS per sample, the scale of AMDF's mean
+   absolute difference, so prevPeriodBetter works unchanged. */
+static int findPitchPeriodFft(sonicStream stream, short* samples,
+                              int* retMinDiff, int* retMaxDiff) {
+  int n = stream->fftSize;
+  int window = stream->maxPeriod;
+  double* re = stream->fftReal;
+  double* im = stream->fftImag;
+  long long* energy = stream->fftEnergy;
+  long long diff, minDiff = 0, maxDiff = 0;
+  int period, bestPeriod = 0, worstPeriod = 0;
+  int i;
+
+  energy[0] = 0;
+  for (i = 0; i < 2 * window; i++) {
+    energy[i + 1] = energy[i] + (long long)samples[i] * samples[i];
+  }
+  for (i = 0; i < n; i++) {
+    re[i] = i < window ? samples[i] : 0.0;
+    im[i] = i < 2 * window ? samples[i] : 0.0;
+  }
+  fftTransform(stream, n);
+  /* Unpack X and Y from Z = X + iY and form C = conj(X) * Y.  Only bins
+     0 .. n/2 are needed: C is Hermitian since r is real. */
+  for (i = 0; i <= n / 2; i++) {
+    int k = (n - i) & (n - 1);
+    double xr = 0.5 * (re[i] + re[k]), xi = 0.5 * (im[i] - im[k]);
+    double yr = 0.5 * (im[i] + im[k]), yi = 0.5 * (re[k] - re[i]);
+    re[i] = xr * yr + xi * yi;
+    im[i] = xr * yi - xi * yr;
+  }
+  /* r is real, so invert at half size: with E[k] = C[k] + C[k + n/2] and
+     O[k] = (C[k] - C[k + n/2]) w^k, w = e^(2 pi i / n), the half-size inverse
+     of E + iO holds r[2m] in its real and r[2m + 1] in its imaginary part.
+     C[k + n/2] = conj(C[n/2 - k]), so bins i and n/2 - i are built together.
+     Results are stored conjugated for the forward-transform inverse. */
+  for (i = 0; i <= n / 4; i++) {
+    int k = n / 2 - i;
+    double ar = re[i], ai = im[i], br = re[k], bi = im[k];
+    fftPackHalf(stream, n, i, ar, ai, br, bi);
+    if (i != 0 && k != i) {
+      fftPackHalf(stream, n, k, br, bi, ar, ai);
+    }
+  }
+  fftTransform(stream, n / 2);
+
+  for (period = stream->minPeriod; period <= stream->maxPeriod; period++) {
+    double r = (period & 1) ? -im[period >> 1] : re[period >> 1];
+    long long corr = llround(r / n);
+    diff = energy[window] + (energy[period + window] - energy[period]) -
+           2 * corr;
+    if (bestPeriod == 0 || diff < minDiff) {
+      minDiff = diff;
+      bestPeriod = period;
+    }
+    if (worstPeriod == 0 || diff > maxDiff) {
+      maxDiff = diff;
+      worstPeriod = period;
+    }
+  }
+  *retMinDiff = (int)sqrt((double)minDiff / window);
+  *retMaxDiff = (int)sqrt((double)maxDiff / window);
+  return bestPeriod;
+}
+
 /* At abrupt ends of voiced words, we can have pitch periods that are better
    approximated by the previous pitch period estimate.  Try to detect this case.
  */
@@ -805,45 +1673,67 @@ static int prevPeriodBetter(sonicStream stream, int minDiff, int maxDiff,
   return 1;
 }
 
-/* Find the pitch period.  This is a critical step, and we may have to try
-   multiple ways to get a good answer.  This version uses Average Magnitude
-   Difference Function (AMDF).  To improve speed, we down sample by an integer
-   factor get in the 11KHz range, and then do it again with a narrower
-   frequency range without down sampling */
-static int findPitchPeriod(sonicStream stream, short* samples,
+/* Return level `level` of the pyramid from input frame `position` on.  Group
+   boundaries are fixed by the stream, so on levels 1 and 2 the first value may
+   start up to pyramidSkip[level] - 1 frames before `position`. */
+static short* pyramidAt(sonicStream stream, int level, int position) {
+  if (level == 0) {
+    return stream->numChannels == 1 ? stream->inputBuffer + position
+                                    : stream->pyramid[0] + position;
+  }
+  return stream->pyramid[level] +
+         (stream->pyramidPhase[level] + position) / stream->pyramidSkip[level];
+}
+
+/* Search periods from minPeriod to maxPeriod frames, clamped to the stream's
+   range, on one level of the pyramid.  Returns the best period in frames. */
+static int searchPyramid(sonicStream stream, int level, int position,
+                         int minPeriod, int maxPeriod, int* minDiff,
+                         int* maxDiff) {
+  int skip = stream->pyramidSkip[level];
+
+  if (minPeriod < stream->minPeriod) {
+    minPeriod = stream->minPeriod;
+  }
+  if (maxPeriod > stream->maxPeriod) {
+    maxPeriod = stream->maxPeriod;
+  }
+  return skip * findPitchPeriodInRange(pyramidAt(stream, level, position),
+                                       minPeriod / skip, maxPeriod / skip,
+                                       minDiff, maxDiff);
+}
+
+/* Find the pitch period of the input at `position`.  This is a critical step,
+   and we may have to try multiple ways to get a good answer.  This version
+   uses Average Magnitude Difference Function (AMDF), coarse to fine over the
+   decimation pyramid: the whole range at about 4KHz, then a narrow range
+   around that answer at the full rate.  Quality 1 adds a pass at the middle
+   level in between, so its full-rate pass can be narrower still. */
+static int findPitchPeriod(sonicStream stream, int position,
                            int preferNewPeriod) {
-  int minPeriod = stream->minPeriod;
-  int maxPeriod = stream->maxPeriod;
+  int coarse = stream->pyramidSkip[2];
+  int middle = stream->pyramidSkip[1];
   int minDiff, maxDiff, retPeriod;
-  int skip = computeSkip(stream, stream->sampleRate);
-  int period;
-
-  if (stream->numChannels == 1 && skip == 1) {
-    period = findPitchPeriodInRange(samples, minPeriod, maxPeriod, &minDiff,
-                                    &maxDiff);
+  int period, radius;
+
+  if (stream->pitchMethod == SONIC_PITCH_FFT) {
+    period = findPitchPeriodFft(stream, pyramidAt(stream, 0, position),
+                                &minDiff, &maxDiff);
+  } else if (coarse == 1 || (stream->quality > 0 && middle == 1)) {
+    /* Low sample rates: search everything at the full rate. */
+    period = searchPyramid(stream, 0, position, stream->minPeriod,
+                           stream->maxPeriod, &minDiff, &maxDiff);
   } else {
-    downSampleInput(stream, samples, skip);
-    period = findPitchPeriodInRange(stream->downSampleBuffer, minPeriod / skip,
-                                    maxPeriod / skip, &minDiff, &maxDiff);
-    if (skip != 1) {
-      period *= skip;
-      minPeriod = period - (skip << 2);
-      maxPeriod = period + (skip << 2);
-      if (minPeriod < stream->minPeriod) {
-        minPeriod = stream->minPeriod;
-      }
-      if (maxPeriod > stream->maxPeriod) {
-        maxPeriod = stream->maxPeriod;
-      }
-      if (stream->numChannels == 1) {
-        period = findPitchPeriodInRange(samples, minPeriod, maxPeriod, &minDiff,
-                                        &maxDiff);
-      } else {
-        downSampleInput(stream, samples, 1);
-        period = findPitchPeriodInRange(stream->downSampleBuffer, minPeriod,
-                                        maxPeriod, &minDiff, &maxDiff);
-      }
+    period = searchPyramid(stream, 2, position, stream->minPeriod,
+                           stream->maxPeriod, &minDiff, &maxDiff);
+    radius = coarse << 2;
+    if (stream->quality > 0) {
+      period = searchPyramid(stream, 1, position, period - radius,
+                             period + radius, &minDiff, &maxDiff);
+      radius = middle << 2;
     }
+    period = searchPyramid(stream, 0, position, period - radius,
+                           period + radius, &minDiff, &maxDiff);
   }
   if (prevPeriodBetter(stream, minDiff, maxDiff, preferNewPeriod)) {
     retPeriod = stream->prevPeriod;
@@ -855,31 +1745,194 @@ static int findPitchPeriod(sonicStream stream, short* samples,
   return retPeriod;
 }
 
-/* Overlap two sound segments, ramp the volume of one down, while ramping the
-   other one from zero up, and add them, storing the result at the output. */
-static void overlapAdd(int numSamples, int numChannels, short* out,
-                       short* rampDown, short* rampUp) {
-  short* o;
-  short* u;
-  short* d;
-  int i, t;
-
-  for (i = 0; i < numChannels; i++) {
-    o = out + i;
-    u = rampUp + i;
-    d = rampDown + i;
-    for (t = 0; t < numSamples; t++) {
-#ifdef SONIC_USE_SIN
-      float ratio = sin(t * M_PI / (2 * numSamples));
-      *o = *d * (1.0f - ratio) + *u * ratio;
-#else
-      *o = (*d * (numSamples - t) + *u * t) / numSamples;
-#endif
-      o += numChannels;
-      d += numChannels;
-      u += numChannels;
+/* Fill rampDown and rampUp with the gains of an n frame crossfade on the
+   stream's curve.  The equal-power curve turns a unit vector by a quarter
+   circle over the overlap; the rotation runs in double, which keeps it far
+   more accurate than float gains need, without calling sin per frame. */
+static void buildRamp(int curve, int n, float* rampDown, float* rampUp) {
+  int t;
+
+  if (curve == SONIC_CURVE_EQUAL_POWER) {
+    double step = M_PI / (2 * n);
+    double c = 1.0, s = 0.0, dc = cos(step), ds = sin(step), next;
+
+    for (t = 0; t < n; t++) {
+      rampDown[t] = (float)c;
+      rampUp[t] = (float)s;
+      next = c * dc - s * ds;
+      s = s * dc + c * ds;
+      c = next;
+    }
+  } else {
+    float scale = 1.0f / n;
+
+    for (t = 0; t < n; t++) {
+      rampDown[t] = (n - t) * scale;
+      rampUp[t] = t * scale;
+    }
+  }
+}
+
+/* Return the cached gain tables for an n frame overlap, building them in the
+   next slot if they are not there.  The tables hold rampDown then rampUp. */
+static const float* findRamp(sonicStream stream, int n) {
+  float* table;
+  int i;
+
+  for (i = 0; i < SONIC_RAMP_SLOTS; i++) {
+    if (stream->rampLength[i] == n) {
+      return stream->rampTables + (long)i * 2 * stream->maxPeriod;
     }
   }
+  i = stream->rampNext;
+  stream->rampNext = (i + 1) % SONIC_RAMP_SLOTS;
+  table = stream->rampTables + (long)i * 2 * stream->maxPeriod;
+  buildRamp(stream->overlapCurve, n, table, table + n);
+  stream->rampLength[i] = n;
+  return table;
+}
+
+/* Crossfade frames [t, numSamples) one frame at a time, any channel count. */
+static void overlapAddScalar(int t, int numSamples, int numChannels,
+                             float* out, const short* rampDown,
+                             const short* rampUp, const float* down,
+                             const float* up) {
+  int c, k;
+
+  for (; t < numSamples; t++) {
+    k = t * numChannels;
+    for (c = 0; c < numChannels; c++) {
+      out[k + c] = rampDown[k + c] * down[t] + rampUp[k + c] * up[t];
+    }
+  }
+}
+
+#ifdef SONIC_SIMD_SSE2
+/* Sign-extend the low or high four shorts of v to floats. */
+static __m128 shortsLoToFloats(__m128i v) {
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+static __m128 shortsHiToFloats(__m128i v) {
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+/* Mono and stereo crossfades, eight samples per step.  Stereo gains are
+   repeated for the two samples of each frame.  Return the first frame left
+   for the scalar loop. */
+static int overlapAddSSE2(int numSamples, int numChannels, float* out,
+                          const short* rampDown, const short* rampUp,
+                          const float* down, const float* up) {
+  __m128i d, u;
+  __m128 gd, gu, gd0, gd1, gu0, gu1;
+  int t = 0;
+
+  if (numChannels == 1) {
+    for (; t + 8 <= numSamples; t += 8) {
+      d = _mm_loadu_si128((const __m128i*)(rampDown + t));
+      u = _mm_loadu_si128((const __m128i*)(rampUp + t));
+      _mm_storeu_ps(out + t,
+                    _mm_add_ps(_mm_mul_ps(shortsLoToFloats(d),
+                                          _mm_loadu_ps(down + t)),
+                               _mm_mul_ps(shortsLoToFloats(u),
+                                          _mm_loadu_ps(up + t))));
+      _mm_storeu_ps(out + t + 4,
+                    _mm_add_ps(_mm_mul_ps(shortsHiToFloats(d),
+                                          _mm_loadu_ps(down + t + 4)),
+                               _mm_mul_ps(shortsHiToFloats(u),
+                                          _mm_loadu_ps(up + t + 4))));
+    }
+  } else if (numChannels == 2) {
+    for (; t + 4 <= numSamples; t += 4) {
+      d = _mm_loadu_si128((const __m128i*)(rampDown + 2 * t));
+      u = _mm_loadu_si128((const __m128i*)(rampUp + 2 * t));
+      gd = _mm_loadu_ps(down + t);
+      gu = _mm_loadu_ps(up + t);
+      gd0 = _mm_unpacklo_ps(gd, gd);
+      gd1 = _mm_unpackhi_ps(gd, gd);
+      gu0 = _mm_unpacklo_ps(gu, gu);
+      gu1 = _mm_unpackhi_ps(gu, gu);
+      _mm_storeu_ps(out + 2 * t,
+                    _mm_add_ps(_mm_mul_ps(shortsLoToFloats(d), gd0),
+                               _mm_mul_ps(shortsLoToFloats(u), gu0)));
+      _mm_storeu_ps(out + 2 * t + 4,
+                    _mm_add_ps(_mm_mul_ps(shortsHiToFloats(d), gd1),
+                               _mm_mul_ps(shortsHiToFloats(u), gu1)));
+    }
+  }
+  return t;
+}
+#endif /* SONIC_SIMD_SSE2 */
+
+#ifdef SONIC_SIMD_NEON
+/* Mono and stereo crossfades, eight samples per step.  Stereo gains are
+   repeated for the two samples of each frame.  Return the first frame left
+   for the scalar loop. */
+static int overlapAddNEON(int numSamples, int numChannels, float* out,
+                          const short* rampDown, const short* rampUp,
+                          const float* down, const float* up) {
+  int16x8_t d, u;
+  float32x4x2_t gd, gu;
+  int t = 0;
+
+  if (numChannels == 1) {
+    for (; t + 8 <= numSamples; t += 8) {
+      d = vld1q_s16(rampDown + t);
+      u = vld1q_s16(rampUp + t);
+      vst1q_f32(out + t,
+                vmlaq_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(d))),
+                                    vld1q_f32(down + t)),
+                          vcvtq_f32_s32(vmovl_s16(vget_low_s16(u))),
+                          vld1q_f32(up + t)));
+      vst1q_f32(out + t + 4,
+                vmlaq_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(d))),
+                                    vld1q_f32(down + t + 4)),
+                          vcvtq_f32_s32(vmovl_s16(vget_high_s16(u))),
+                          vld1q_f32(up + t + 4)));
+    }
+  } else if (numChannels == 2) {
+    for (; t + 4 <= numSamples; t += 4) {
+      d = vld1q_s16(rampDown + 2 * t);
+      u = vld1q_s16(rampUp + 2 * t);
+      gd = vzipq_f32(vld1q_f32(down + t), vld1q_f32(down + t));
+      gu = vzipq_f32(vld1q_f32(up + t), vld1q_f32(up + t));
+      vst1q_f32(out + 2 * t,
+                vmlaq_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(d))),
+                                    gd.val[0]),
+                          vcvtq_f32_s32(vmovl_s16(vget_low_s16(u))),
+                          gu.val[0]));
+      vst1q_f32(out + 2 * t + 4,
+                vmlaq_f32(vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(d))),
+                                    gd.val[1]),
+                          vcvtq_f32_s32(vmovl_s16(vget_high_s16(u))),
+                          gu.val[1]));
+    }
+  }
+  return t;
+}
+#endif /* SONIC_SIMD_NEON */
+
+/* Crossfade numSamples interleaved frames from rampDown into rampUp, all
+   channels in one pass, with gains from the stream's cached tables.  Overlaps
+   are at most a pitch period, so they always fit the tables. */
+static void overlapAdd(sonicStream stream, int numSamples, int numChannels,
+                       float* out, short* rampDown, short* rampUp) {
+  const float* down;
+  const float* up;
+  int t = 0;
+
+  if (numSamples <= 0) {
+    return;
+  }
+  down = findRamp(stream, numSamples);
+  up = down + numSamples;
+#if defined(SONIC_SIMD_SSE2)
+  t = overlapAddSSE2(numSamples, numChannels, out, rampDown, rampUp, down, up);
+#elif defined(SONIC_SIMD_NEON)
+  t = overlapAddNEON(numSamples, numChannels, out, rampDown, rampUp, down, up);
+#endif
+  overlapAddScalar(t, numSamples, numChannels, out, rampDown, rampUp, down,
+                   up);
 }
 
 /* Just move the new samples in the output buffer to the pitch buffer */
@@ -887,17 +1940,15 @@ static int moveNewSamplesToPitchBuffer(sonicStream stream,
                                        int originalNumOutputSamples) {
   int numSamples = stream->numOutputSamples - originalNumOutputSamples;
   int numChannels = stream->numChannels;
-  int pitchBufferSize = stream->pitchBufferSize;
 
-  if (stream->numPitchSamples + numSamples > pitchBufferSize) {
-    stream->pitchBufferSize += (pitchBufferSize >> 1) + numSamples;
-    stream->pitchBuffer = (short*)sonicRealloc(
-        stream->pitchBuffer, pitchBufferSize, stream->pitchBufferSize,
-        sizeof(short) * numChannels);
+  if (!reserveFloatFrames(stream, &stream->pitchBase, &stream->pitchBuffer,
+                          &stream->pitchBufferSize, stream->numPitchSamples,
+                          numSamples, numChannels)) {
+    return 0;
   }
   memcpy(stream->pitchBuffer + stream->numPitchSamples * numChannels,
          stream->outputBuffer + originalNumOutputSamples * numChannels,
-         numSamples * sizeof(short) * numChannels);
+         numSamples * sizeof(float) * numChannels);
   stream->numOutputSamples = originalNumOutputSamples;
   stream->numPitchSamples += numSamples;
   return 1;
@@ -905,18 +1956,15 @@ static int moveNewSamplesToPitchBuffer(sonicStream stream,
 
 /* Remove processed samples from the pitch buffer. */
 static void removePitchSamples(sonicStream stream, int numSamples) {
-  int numChannels = stream->numChannels;
-  short* source = stream->pitchBuffer + numSamples * numChannels;
-
   if (numSamples == 0) {
     return;
   }
-  if (numSamples != stream->numPitchSamples) {
-    memmove(
-        stream->pitchBuffer, source,
-        (stream->numPitchSamples - numSamples) * sizeof(short) * numChannels);
-  }
   stream->numPitchSamples -= numSamples;
+  if (stream->numPitchSamples > 0) {
+    stream->pitchBuffer += numSamples * stream->numChannels;
+  } else {
+    stream->pitchBuffer = stream->pitchBase;
+  }
 }
 
 /* Approximate the sinc function times a Hann window from the sinc table. */
@@ -931,53 +1979,213 @@ static int findSincCoefficient(int i, int ratio, int width) {
   return ((leftVal * (width - position) + rightVal * position) << 1) / width;
 }
 
-/* Return 1 if value >= 0, else -1.  This represents the sign of value. */
-static int getSign(int value) { return value >= 0 ? 1 : -1; }
+/* Return the greatest common divisor of two positive numbers. */
+static int greatestCommonDivisor(int a, int b) {
+  int t;
+
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Make the filter bank match the rates adjustRate steps with, rebuilding it
+   if they changed.  An output frame rateOldRate / rateNewRate input frames
+   after the last lands ratio + 1 grid steps before the next input frame,
+   where the grid divides a frame into grid * rateNewRate steps, as the old
+   per-sample sinc interpolation did.  When the reduced ratio has at most
+   SONIC_RATE_MAX_PHASES phases, row r holds the taps for
+   ratio = grid * (r + 1) - 1.  Otherwise row k holds the taps for an output
+   frame k / SINC_LOBE_POINTS of a frame before the next input frame; each
+   tap moves linearly through the sinc table between rows, so rateTaps
+   blends the two around a phase into the same taps.  Either way the ratio is
+   the exact one.  Changing it restarts the phase. */
+static void selectRateBank(sonicStream stream, int oldSampleRate,
+                           int newSampleRate) {
+  int N = SINC_FILTER_POINTS;
+  int g, newRate, oldRate, r, i;
+  float* row;
 
-/* Interpolate the new output sample. */
-static short interpolate(sonicStream stream, short* in, int oldSampleRate,
-                         int newSampleRate) {
-  /* Compute N-point sinc FIR-filter here.  Clip rather than overflow. */
+  if (stream->rateNewRate != 0 && stream->rateKeyNew == newSampleRate &&
+      stream->rateKeyOld == oldSampleRate) {
+    return;
+  }
+  g = greatestCommonDivisor(newSampleRate, oldSampleRate);
+  newRate = newSampleRate / g;
+  oldRate = oldSampleRate / g;
+  if (newRate <= SONIC_RATE_MAX_PHASES) {
+    for (r = 0; r < newRate; r++) {
+      row = stream->rateBank + r * N;
+      for (i = 0; i < N; i++) {
+        /* The coefficients are scaled by 65536. */
+        row[i] = findSincCoefficient(i, g * (r + 1) - 1, g * newRate) *
+                 (1.0f / 65536.0f);
+      }
+    }
+    stream->ratePhaseScale = 0.0f;
+  } else {
+    for (r = 0; r <= SINC_LOBE_POINTS; r++) {
+      row = stream->rateBank + r * N;
+      for (i = 0; i < N; i++) {
+        row[i] = sincTable[i * SINC_LOBE_POINTS + r] * (2.0f / 65536.0f);
+      }
+    }
+    stream->ratePhaseScale = (float)SINC_LOBE_POINTS / (float)newSampleRate;
+  }
+  if (newRate != stream->rateNewRate || oldRate != stream->rateOldRate) {
+    stream->oldRatePosition = 0;
+    stream->newRatePosition = 0;
+  }
+  stream->rateKeyNew = newSampleRate;
+  stream->rateKeyOld = oldSampleRate;
+  stream->rateNewRate = newRate;
+  stream->rateOldRate = oldRate;
+  stream->rateGrid = g;
+}
+
+/* The taps for the output frame `step` grid steps past the start of its
+   phase: a bank row, or a blend of two into `blend`. */
+static const float* rateTaps(sonicStream stream, int step, float* blend) {
+  int N = SINC_FILTER_POINTS;
+  const float* row;
+  float p, f;
+  int k, i;
+
+  if (stream->ratePhaseScale == 0.0f) {
+    return stream->rateBank + step * N;
+  }
+  p = (float)(stream->rateGrid * (step + 1) - 1) * stream->ratePhaseScale;
+  k = (int)p;
+  if (k > SINC_LOBE_POINTS - 1) {
+    k = SINC_LOBE_POINTS - 1;
+  }
+  f = p - (float)k;
+  row = stream->rateBank + k * N;
+  for (i = 0; i < N; i++) {
+    blend[i] = row[i] + (row[i + N] - row[i]) * f;
+  }
+  return blend;
+}
+
+/* Filter one output frame: out[c] is the dot product of the taps with channel
+   c of the SINC_FILTER_POINTS frames at in.  Floats have the headroom for
+   the filter's overshoot, so nothing saturates until samples are read out as
+   shorts. */
+static void rateDotScalar(const float* taps, const float* in, int numChannels,
+                          float* out) {
+  float total;
+  int c, i;
+
+  for (c = 0; c < numChannels; c++) {
+    total = 0.0f;
+    for (i = 0; i < SINC_FILTER_POINTS; i++) {
+      total += taps[i] * in[i * numChannels + c];
+    }
+    out[c] = total;
+  }
+}
+
+#if SINC_FILTER_POINTS % 4 != 0
+#error "The SIMD rate kernels take four taps per step."
+#endif
+
+#ifdef SONIC_SIMD_SSE2
+/* Mono and stereo dot products, four taps per step.  Stereo multiplies two
+   frames at once by taps repeated per frame, and the two halves of the sum
+   are left and right.  Return 0 for other channel counts. */
+static int rateDotSSE2(const float* taps, const float* in, int numChannels,
+                       float* out) {
+  __m128 acc = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), t;
+  int i;
+
+  if (numChannels == 1) {
+    for (i = 0; i + 4 <= SINC_FILTER_POINTS; i += 4) {
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(taps + i),
+                                       _mm_loadu_ps(in + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    out[0] = _mm_cvtss_f32(acc);
+    return 1;
+  }
+  if (numChannels == 2) {
+    for (i = 0; i + 4 <= SINC_FILTER_POINTS; i += 4) {
+      t = _mm_loadu_ps(taps + i);
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_unpacklo_ps(t, t),
+                                       _mm_loadu_ps(in + 2 * i)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_unpackhi_ps(t, t),
+                                         _mm_loadu_ps(in + 2 * i + 4)));
+    }
+    acc = _mm_add_ps(acc, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    _mm_storel_pi((__m64*)out, acc);
+    return 1;
+  }
+  return 0;
+}
+#endif /* SONIC_SIMD_SSE2 */
+
+#ifdef SONIC_SIMD_NEON
+/* Mono and stereo dot products, four taps per step.  Stereo multiplies two
+   frames at once by taps repeated per frame, and the two halves of the sum
+   are left and right.  Return 0 for other channel counts. */
+static int rateDotNEON(const float* taps, const float* in, int numChannels,
+                       float* out) {
+  float32x4_t acc = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+  float32x4x2_t t;
+  float32x2_t sum;
   int i;
-  int total = 0;
-  int position = stream->newRatePosition * oldSampleRate;
-  int leftPosition = stream->oldRatePosition * newSampleRate;
-  int rightPosition = (stream->oldRatePosition + 1) * newSampleRate;
-  int ratio = rightPosition - position - 1;
-  int width = rightPosition - leftPosition;
-  int weight, value;
-  int oldSign;
-  int overflowCount = 0;
-
-  for (i = 0; i < SINC_FILTER_POINTS; i++) {
-    weight = findSincCoefficient(i, ratio, width);
-    value = in[i * stream->numChannels] * weight;
-    oldSign = getSign(total);
-    total += value;
-    if (oldSign != getSign(total) && getSign(value) == oldSign) {
-      /* We must have overflowed.  This can happen with a sinc filter. */
-      overflowCount += oldSign;
+
+  if (numChannels == 1) {
+    for (i = 0; i + 4 <= SINC_FILTER_POINTS; i += 4) {
+      acc = vmlaq_f32(acc, vld1q_f32(taps + i), vld1q_f32(in + i));
     }
+    out[0] = vaddvq_f32(acc);
+    return 1;
   }
-  /* It is better to clip than to wrap if there was a overflow. */
-  if (overflowCount > 0) {
-    return SHRT_MAX;
-  } else if (overflowCount < 0) {
-    return SHRT_MIN;
+  if (numChannels == 2) {
+    for (i = 0; i + 4 <= SINC_FILTER_POINTS; i += 4) {
+      t = vzipq_f32(vld1q_f32(taps + i), vld1q_f32(taps + i));
+      acc = vmlaq_f32(acc, t.val[0], vld1q_f32(in + 2 * i));
+      acc1 = vmlaq_f32(acc1, t.val[1], vld1q_f32(in + 2 * i + 4));
+    }
+    acc = vaddq_f32(acc, acc1);
+    sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    vst1_f32(out, sum);
+    return 1;
   }
-  return total >> 16;
+  return 0;
 }
+#endif /* SONIC_SIMD_NEON */
 
-/* Change the rate.  Interpolate with a sinc FIR filter using a Hann window. */
+/* Filter one output frame with the widest kernel for the channel count. */
+static void rateDot(const float* taps, const float* in, int numChannels,
+                    float* out) {
+#if defined(SONIC_SIMD_SSE2)
+  if (rateDotSSE2(taps, in, numChannels, out)) {
+    return;
+  }
+#elif defined(SONIC_SIMD_NEON)
+  if (rateDotNEON(taps, in, numChannels, out)) {
+    return;
+  }
+#endif
+  rateDotScalar(taps, in, numChannels, out);
+}
+
+/* Change the rate.  Interpolate with a sinc FIR filter using a Hann window,
+   taking each output frame's taps from the polyphase filter bank. */
 static int adjustRate(sonicStream stream, float rate,
                       int originalNumOutputSamples) {
   int newSampleRate = stream->sampleRate / rate;
   int oldSampleRate = stream->sampleRate;
   int numChannels = stream->numChannels;
-  int position;
-  short *in, *out;
-  int i;
+  int position, newRate, oldRate, numPositions;
+  float* out;
   int N = SINC_FILTER_POINTS;
+  float blend[SINC_FILTER_POINTS];
 
   /* Set these values to help with the integer math */
   while (newSampleRate > (1 << 14) || oldSampleRate > (1 << 14)) {
@@ -990,29 +2198,40 @@ static int adjustRate(sonicStream stream, float rate,
   if (!moveNewSamplesToPitchBuffer(stream, originalNumOutputSamples)) {
     return 0;
   }
-  /* Leave at least N pitch sample in the buffer */
-  for (position = 0; position < stream->numPitchSamples - N; position++) {
-    while ((stream->oldRatePosition + 1) * newSampleRate >
-           stream->newRatePosition * oldSampleRate) {
-      if (!enlargeOutputBufferIfNeeded(stream, 1)) {
-        return 0;
-      }
-      out = stream->outputBuffer + stream->numOutputSamples * numChannels;
-      in = stream->pitchBuffer + position * numChannels;
-      for (i = 0; i < numChannels; i++) {
-        *out++ = interpolate(stream, in, oldSampleRate, newSampleRate);
-        in++;
-      }
+  selectRateBank(stream, oldSampleRate, newSampleRate);
+  newRate = stream->rateNewRate;
+  oldRate = stream->rateOldRate;
+  /* Leave at least N pitch sample in the buffer.  Stepping over numPositions
+     input frames makes fewer than numPositions * newRate / oldRate + 1
+     output frames. */
+  numPositions = stream->numPitchSamples - N;
+  if (numPositions > 0 &&
+      !enlargeOutputBufferIfNeeded(
+          stream, (int)((long)numPositions * newRate / oldRate) + 2)) {
+    return 0;
+  }
+  out = stream->outputBuffer + stream->numOutputSamples * numChannels;
+  for (position = 0; position < numPositions; position++) {
+    while ((stream->oldRatePosition + 1) * newRate >
+           stream->newRatePosition * oldRate) {
+      rateDot(rateTaps(stream,
+                       (stream->oldRatePosition + 1) * newRate -
+                           stream->newRatePosition * oldRate - 1,
+                       blend),
+              stream->pitchBuffer + position * numChannels, numChannels, out);
+      out += numChannels;
       stream->newRatePosition++;
       stream->numOutputSamples++;
     }
     stream->oldRatePosition++;
-    if (stream->oldRatePosition == oldSampleRate) {
+    if (stream->oldRatePosition == oldRate) {
       stream->oldRatePosition = 0;
       stream->newRatePosition = 0;
     }
   }
-  removePitchSamples(stream, position);
+  if (numPositions > 0) {
+    removePitchSamples(stream, numPositions);
+  }
   return 1;
 }
 
@@ -1032,7 +2251,7 @@ static int skipPitchPeriod(sonicStream stream, short* samples, float speed,
   if (!enlargeOutputBufferIfNeeded(stream, newSamples)) {
     return 0;
   }
-  overlapAdd(newSamples, numChannels,
+  overlapAdd(stream, newSamples, numChannels,
              stream->outputBuffer + stream->numOutputSamples * numChannels,
              samples, samples + period * numChannels);
   stream->numOutputSamples += newSamples;
@@ -1043,7 +2262,7 @@ static int skipPitchPeriod(sonicStream stream, short* samples, float speed,
 static int insertPitchPeriod(sonicStream stream, short* samples, float speed,
                              int period) {
   long newSamples;
-  short* out;
+  float* out;
   int numChannels = stream->numChannels;
 
   if (speed <= 0.5f) {
@@ -1055,10 +2274,11 @@ static int insertPitchPeriod(sonicStream stream, short* samples, float speed,
     return 0;
   }
   out = stream->outputBuffer + stream->numOutputSamples * numChannels;
-  memcpy(out, samples, period * sizeof(short) * numChannels);
+  shortsToFloats(out, samples, period * numChannels);
   out =
       stream->outputBuffer + (stream->numOutputSamples + period) * numChannels;
-  overlapAdd(newSamples, numChannels, out, samples + period * numChannels,
+  overlapAdd(stream, newSamples, numChannels, out,
+             samples + period * numChannels,
              samples);
   stream->numOutputSamples += period + newSamples;
   return newSamples;
@@ -1107,7 +2327,7 @@ static int changeSpeed(sonicStream stream, float speed) {
     } else {
       /* We are in the remaining cases, either inserting/removing a pitch period
          for speed < 2.0X, or a portion of one for speed >= 2.0X. */
-      period = findPitchPeriod(stream, samples, 1);
+      period = findPitchPeriod(stream, position, 1);
 #ifdef SONIC_SPECTROGRAM
       if (stream->spectrogram != NULL) {
         sonicAddPitchPeriodToSpectrogram(stream->spectrogram, samples, period,
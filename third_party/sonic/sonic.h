@@ -73,6 +73,8 @@ extern "C" {
  * symbols and call the sonicIntXXX functions directly.
  */
 #define sonicCreateStream sonicIntCreateStream
+#define sonicCreateStreamRT sonicIntCreateStreamRT
+#define sonicSetAllocationHook sonicIntSetAllocationHook
 #define sonicDestroyStream sonicIntDestroyStream
 #define sonicWriteFloatToStream sonicIntWriteFloatToStream
 #define sonicWriteShortToStream sonicIntWriteShortToStream
@@ -81,7 +83,9 @@ extern "C" {
 #define sonicReadShortFromStream sonicIntReadShortFromStream
 #define sonicReadUnsignedCharFromStream sonicIntReadUnsignedCharFromStream
 #define sonicFlushStream sonicIntFlushStream
+#define sonicClearStream sonicIntClearStream
 #define sonicSamplesAvailable sonicIntSamplesAvailable
+#define sonicSamplesPending sonicIntSamplesPending
 #define sonicGetSpeed sonicIntGetSpeed
 #define sonicSetSpeed sonicIntSetSpeed
 #define sonicGetPitch sonicIntGetPitch
@@ -92,6 +96,10 @@ extern "C" {
 #define sonicSetVolume sonicIntSetVolume
 #define sonicGetQuality sonicIntGetQuality
 #define sonicSetQuality sonicIntSetQuality
+#define sonicGetPitchMethod sonicIntGetPitchMethod
+#define sonicSetPitchMethod sonicIntSetPitchMethod
+#define sonicGetOverlapCurve sonicIntGetOverlapCurve
+#define sonicSetOverlapCurve sonicIntSetOverlapCurve
 #define sonicGetSampleRate sonicIntGetSampleRate
 #define sonicSetSampleRate sonicIntSetSampleRate
 #define sonicGetNumChannels sonicIntGetNumChannels
@@ -134,6 +142,14 @@ extern "C" {
 /* These are used to down-sample some inputs to improve speed */
 #define SONIC_AMDF_FREQ 4000
 
+/* Pitch period estimators, see sonicSetPitchMethod. */
+#define SONIC_PITCH_AMDF 0
+#define SONIC_PITCH_FFT 1
+
+/* Overlap-add crossfade curves, see sonicSetOverlapCurve. */
+#define SONIC_CURVE_LINEAR 0
+#define SONIC_CURVE_EQUAL_POWER 1
+
 struct sonicStreamStruct;
 typedef struct sonicStreamStruct* sonicStream;
 
@@ -143,6 +159,23 @@ typedef struct sonicStreamStruct* sonicStream;
 /* Create a sonic stream.  Return NULL only if we are out of memory and cannot
   allocate the stream. Set numChannels to 1 for mono, and 2 for stereo. */
 sonicStream sonicCreateStream(int sampleRate, int numChannels);
+/* Create a sonic stream for a real-time thread.  The stream and all of its
+   buffers come from one allocation, sized up front for the worst case, so
+   writing, reading and flushing never allocate.  That holds as long as each
+   write is at most maxBlock samples, the output is read empty before the next
+   write (a flush may find one write's output unread), and pitch and rate stay
+   at 1.  Speed is clamped to minSpeed .. maxSpeed.  A write that would need
+   more room fails instead of growing a buffer.  Setting the pitch method,
+   sample rate or number of channels still allocates.  Return NULL only if we
+   are out of memory. */
+sonicStream sonicCreateStreamRT(int sampleRate, int numChannels, int maxBlock,
+                                float minSpeed, float maxSpeed);
+/* Called with the number of bytes whenever a stream from sonicCreateStreamRT
+   asks for memory after it was created, whether or not it then gets any.  A
+   debug build can use this to trap allocations on the audio thread. */
+typedef void (*sonicAllocationHook)(sonicStream stream, long bytes);
+/* Set the allocation hook for all streams, or NULL (the default) for none. */
+void sonicSetAllocationHook(sonicAllocationHook hook);
 /* Destroy the sonic stream. */
 void sonicDestroyStream(sonicStream stream);
 /* Attach user data to the stream. */
@@ -161,11 +194,14 @@ int sonicWriteShortToStream(sonicStream stream, const short* samples, int numSam
 int sonicWriteUnsignedCharToStream(sonicStream stream, const unsigned char* samples,
                                    int numSamples);
 /* Use this to read floating point data out of the stream.  Sometimes no data
-   will be available, and zero is returned, which is not an error condition. */
+   will be available, and zero is returned, which is not an error condition.
+   The stream processes in float, so this is the lossless read: samples are
+   not clipped and may exceed [-1, 1] where the rate filter overshoots. */
 int sonicReadFloatFromStream(sonicStream stream, float* samples,
                              int maxSamples);
 /* Use this to read 16-bit data out of the stream.  Sometimes no data will
-   be available, and zero is returned, which is not an error condition. */
+   be available, and zero is returned, which is not an error condition.
+   Samples are rounded and clamped to the short range. */
 int sonicReadShortFromStream(sonicStream stream, short* samples,
                              int maxSamples);
 /* Use this to read 8-bit unsigned data out of the stream.  Sometimes no data
@@ -176,8 +212,13 @@ int sonicReadUnsignedCharFromStream(sonicStream stream, unsigned char* samples,
    has.  No extra delay will be added to the output, but flushing in the middle
    of words could introduce distortion. */
 int sonicFlushStream(sonicStream stream);
+/* Discard everything buffered in the stream without producing output, e.g.
+   before restarting it at another position. */
+void sonicClearStream(sonicStream stream);
 /* Return the number of samples in the output buffer */
 int sonicSamplesAvailable(sonicStream stream);
+/* Return the number of input samples not yet turned into output */
+int sonicSamplesPending(sonicStream stream);
 /* Get the speed of the stream. */
 float sonicGetSpeed(sonicStream stream);
 /* Set the speed of the stream. */
@@ -206,6 +247,24 @@ int sonicGetQuality(sonicStream stream);
 /* Set the "quality".  Default 0 is virtually as good as 1, but very much
  * faster. */
 void sonicSetQuality(sonicStream stream, int quality);
+/* Get the pitch period estimator. */
+int sonicGetPitchMethod(sonicStream stream);
+/* Select the pitch period estimator.  SONIC_PITCH_AMDF (the default) searches
+   every candidate period directly.  SONIC_PITCH_FFT gets the difference
+   function for all periods at once from an FFT autocorrelation, always at the
+   full sample rate, so quality does not affect it.  This allocates, so call
+   it while setting the stream up.  Return 0 if memory allocation failed, in
+   which case the method is unchanged. */
+int sonicSetPitchMethod(sonicStream stream, int method);
+/* Get the overlap-add crossfade curve. */
+int sonicGetOverlapCurve(sonicStream stream);
+/* Select the curve pitch periods are crossfaded with when speeding up or
+   slowing down.  SONIC_CURVE_LINEAR (the default, unless built with
+   SONIC_USE_SIN) keeps the amplitude of correlated periods constant;
+   SONIC_CURVE_EQUAL_POWER keeps the power of uncorrelated ones constant,
+   which smooths noisy material.  Safe to change at any time; it never
+   allocates. */
+void sonicSetOverlapCurve(sonicStream stream, int curve);
 /* Get the sample rate of the stream. */
 int sonicGetSampleRate(sonicStream stream);
 /* Set the sample rate of the stream.  This will drop any samples that have not